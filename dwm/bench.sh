@@ -0,0 +1,119 @@
+#!/bin/sh
+# Runs dwm on a private Xvfb against the transient load generator and reports,
+# for each number of clients, the throughput and latency of manage, tag
+# switching, layout switching, title churn and unmanage.
+# usage: bench.sh [clients...]
+
+stats=/tmp/dwm-stats
+display=${BENCHDISPLAY:-:98}
+counts=${*:-10 100 1000}
+titlerate=${BENCHTITLERATE:-10} # title changes per second and client
+
+command -v Xvfb >/dev/null || { echo "bench: Xvfb not found" >&2; exit 1; }
+command -v xsetroot >/dev/null || { echo "bench: xsetroot not found" >&2; exit 1; }
+
+Xvfb "$display" -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+pids=
+trap 'kill $pids $xvfb 2>/dev/null' EXIT INT TERM
+export DISPLAY="$display"
+i=0
+until xsetroot -name "" 2>/dev/null; do
+	i=$((i + 1))
+	[ $i -gt 50 ] && { echo "bench: Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+# fake signals, spaced out so that they aren't coalesced
+fsig() {
+	xsetroot -name "z:$*"
+	sleep 0.05
+}
+
+# count of a row of the statistics, 0 if absent
+count() {
+	awk -v row="$1" '$1 == row && NF == 6 { print $2; found = 1; exit }
+	                 END { if (!found) print 0 }' "$stats" 2>/dev/null
+}
+
+# waits until dwm has done row at least n times since the last reset
+waitfor() {
+	i=0
+	while :; do
+		rm -f "$stats"
+		fsig stat
+		sleep 0.1
+		[ "$(count "$1")" -ge "$2" ] && return
+		i=$((i + 1))
+		[ $i -gt 600 ] && { echo "bench: timed out waiting for $1" >&2; return; }
+	done
+}
+
+# phase name row command...: runs command on freshly reset statistics and
+# reports the row of the histograms it is measured by
+phase() {
+	name=$1 row=$2
+	shift 2
+	fsig clst
+	t0=$(date +%s.%N)
+	"$@"
+	t1=$(date +%s.%N)
+	rm -f "$stats"
+	fsig stat
+	sleep 0.2
+	awk -v n="$n" -v name="$name" -v row="$row" -v t0="$t0" -v t1="$t1" '
+		$1 == row && NF == 6 {
+			printf "%8d %-10s %-16s %8d %10.0f %10.0f %10s %10s %10s\n",
+			       n, name, row, $2, $2 / (t1 - t0),
+			       $6 > 0 ? $2 * 1000 / $6 : 0, $3, $4, $5
+			exit
+		}' "$stats"
+}
+
+manageall() {
+	./transient -n "$n" -s 0x0 -t -1 -m "$titlerate" -p &
+	client=$!
+	pids="$pids $client"
+	waitfor manage "$n"
+}
+
+switchtags() {
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		fsig view ui 2
+		fsig view ui 1
+	done
+}
+
+switchlayouts() {
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		fsig sllt i 2
+		fsig sllt i 0
+	done
+}
+
+churntitles() {
+	kill -USR1 "$client"
+	sleep 2
+	kill -USR1 "$client"
+}
+
+unmanageall() {
+	kill "$client"
+	waitfor unmanage "$n"
+}
+
+./dwm &
+dwm=$!
+pids="$dwm"
+sleep 1
+
+printf "%8s %-10s %-16s %8s %10s %10s %10s %10s %10s\n" "clients" "phase" \
+       "measured" "count" "ops/s" "busy ops/s" "p50(us)" "p99(us)" "max(us)"
+for n in $counts; do
+	phase manage manage manageall
+	phase tags view switchtags
+	phase layouts arrange switchlayouts
+	phase titles PropertyNotify churntitles
+	phase unmanage unmanage unmanageall
+done
+kill "$dwm" 2>/dev/null
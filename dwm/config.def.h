@@ -197,7 +197,6 @@ static void togglefocusarea(const Arg *arg);
 static void togglefocusfloat(const Arg *arg);
 static void togglefullscreen(const Arg *arg);
 static void vieworprev(const Arg *arg);
-static int hasleasttag(Client *c, int tag);
 static unsigned int windowlineupcn(void);
 static void windowlineupcv(const Arg *arg);
 static void windowlineups(const Arg *arg);
@@ -506,6 +505,7 @@ static const Button buttons[] = {
 /* signal definitions */
 static Signal signals[] = {
 	/* signame              function */
+	{ "clst",               resetstats },
 	{ "fclg",               focuslast },
 	{ "fclv",               focuslastvisible },
 	{ "fcsk",               focusstackalt },
@@ -516,6 +516,9 @@ static Signal signals[] = {
 	{ "scrm",               scratchmark },
 	{ "sfvw",               shiftview },
 	{ "sftg",               shifttag },
+	{ "sllt",               setltorprev },
+	{ "stat",               dumpstats },
+	{ "trce",               toggletrace },
 	{ "view",               view },
 	{ "wlnc",               windowlineupcv },
 	{ "wlns",               windowlineups },
@@ -957,13 +960,10 @@ scratchhide(const Arg *arg)
 void
 scratchhidevisible(const Arg *arg)
 {
-        unsigned long t = 0;
-
         for (Client *c = selmon->clients; c; c = c->next)
                 if (c->scratchkey > 0 && ISVISIBLE(c)) {
                         c->tags = 0;
-                        XChangeProperty(dpy, c->win, netatom[NetWMDesktop], XA_CARDINAL, 32,
-                                        PropModeReplace, (unsigned char *) &t, 1);
+                        setclientdesktop(c, 0);
                 }
         focus(NULL);
         arrange(selmon);
@@ -1062,36 +1062,40 @@ vieworprev(const Arg *arg)
 	view((arg->ui & TAGMASK) == selmon->tagset[selmon->seltags] ? &((Arg){0}) : arg);
 }
 
-int
-hasleasttag(Client *c, int tag)
-{
-        for (int i = 0; i < tag; i++)
-                if (1 << i & c->tags)
-                        return 0;
-        return 1 << tag & c->tags;
-}
-
+/* The clients by their least tag, those without tags after each monitor, for
+ * windowswitcherc; returns the row of the selected client. */
 unsigned int
 windowlineupcn(void)
 {
         unsigned int i = 0, n = 0;
+        int k = 0, len;
+        Window *wins;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	for (Monitor *m = mons; m; m = m->next)
+                for (Client *c = m->clients; c; c = c->next)
+                        k++;
+        wins = ecalloc(k ? k : 1, sizeof(Window));
+        len = k;
+        /* filled from the end, switchers list from there */
 	for (Monitor *m = mons; m; m = m->next) {
                 for (int t = 0; t < LENGTH(tags); t++)
                         for (Client *c = m->clients; c; c = c->next)
-                                if (hasleasttag(c, t)) {
-                                        XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-                                                        PropModePrepend, (unsigned char *) &(c->win), 1);
+                                if ((c->tags & -c->tags) == 1u << t) {
+                                        wins[--k] = c->win;
                                         if (c == selmon->sel)
                                                 n = i;
                                         i++;
                                 }
                 for (Client *c = m->clients; c; c = c->next)
                         if (!c->tags)
-                                XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-                                                PropModePrepend, (unsigned char *) &(c->win), 1);
+                                wins[--k] = c->win;
         }
+        XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)(wins + k), len - k);
+        XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)(wins + k), len - k);
+        stackinglineup = 1;
+        free(wins);
         return n;
 }
 
@@ -1100,20 +1104,19 @@ windowlineupcv(const Arg *arg) {
         windowlineupcn();
 }
 
+/* _NET_CLIENT_LIST_STACKING is kept in this order, _NET_CLIENT_LIST gets it
+ * for scripts */
 void
 windowlineups(const Arg *arg)
 {
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-        for (Client *c = selmon->stack; c; c = c->snext)
-                XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-                                PropModePrepend, (unsigned char *) &(c->win), 1);
-	for (Monitor *m = mons; m; m = m->next) {
-                if (m == selmon)
-                        continue;
-                for (Client *c = m->stack; c; c = c->snext)
-                        XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
-                                        PropModePrepend, (unsigned char *) &(c->win), 1);
-        }
+        int n;
+        Window *wins = stacklineup(&n);
+
+        XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)wins, n);
+        free(wins);
+        if (stackingdirty || stackinglineup)
+                updateclientstacking();
 }
 
 void
@@ -1248,17 +1251,8 @@ static void center(Client *c);
 static void markscratch(Client *c, int key);
 
 static void
-applyrules(Client *c)
+applyrules(Client *c, const char *class, const char *instance, const char *role)
 {
-        char role[16] = "";
-	const char *class, *instance;
-	XClassHint ch = { NULL, NULL };
-
-	XGetClassHint(dpy, c->win, &ch);
-	class = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name ? ch.res_name : broken;
-        gettextprop(c->win, wmatom[WMWindowRole], role, sizeof role);
-
         if (strcmp(instance, "crx_cinhimbnkkaeohfgghhklpknlkffjgod") == 0) {
                 markscratch(c, 2);
                 c->isfloating = 1;
@@ -1336,9 +1330,6 @@ applyrules(Client *c)
                 c->bw = 0;
         }
 
-        XFree(ch.res_class);
-        XFree(ch.res_name);
-
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 }
 
@@ -18,13 +18,16 @@ XINERAMAFLAGS = -DXINERAMA
 FREETYPELIBS = -lfontconfig -lXft
 FREETYPEINC = /usr/include/freetype2
 
+# xcb, for pipelined requests on the Xlib connection
+XCBLIBS = -lX11-xcb -lxcb
+
 # fribidi
 BIDILIBS = -lfribidi
 BIDIINC = /usr/include/fribidi
 
 # includes and libs
 INCS = -I${X11INC} -I${FREETYPEINC} -I${BIDIINC}
-LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${FREETYPELIBS} ${BIDILIBS}
+LIBS = -L${X11LIB} -lX11 ${XCBLIBS} ${XINERAMALIBS} ${FREETYPELIBS} ${BIDILIBS} -lpthread
 
 # flags
 CPPFLAGS = -D_DEFAULT_SOURCE -D_XOPEN_SOURCE=700L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS}
@@ -34,21 +34,59 @@
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
+#include <X11/XKBlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
+#include <X11/Xlib-xcb.h>
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
 #include <X11/Xft/Xft.h>
 /* custom */
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 
 #include "drw.h"
+#include "record.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
+/* count the requests dwm blocks on for a reply, see opbegin */
+#define XGetKeyboardMapping(...)        (roundtrips++, XGetKeyboardMapping(__VA_ARGS__))
+#define XGetModifierMapping(...)        (roundtrips++, XGetModifierMapping(__VA_ARGS__))
+#define XGetSelectionOwner(...)         (roundtrips++, XGetSelectionOwner(__VA_ARGS__))
+#define XGetTextProperty(...)           (roundtrips++, XGetTextProperty(__VA_ARGS__))
+#define XGetTransientForHint(...)       (roundtrips++, XGetTransientForHint(__VA_ARGS__))
+#define XGetWMHints(...)                (roundtrips++, XGetWMHints(__VA_ARGS__))
+#define XGetWMNormalHints(...)          (roundtrips++, XGetWMNormalHints(__VA_ARGS__))
+#define XGetWMProtocols(...)            (roundtrips++, XGetWMProtocols(__VA_ARGS__))
+#define XGetWindowAttributes(...)       (roundtrips++, XGetWindowAttributes(__VA_ARGS__))
+#define XGetWindowProperty(...)         (roundtrips++, XGetWindowProperty(__VA_ARGS__))
+#define XGrabKeyboard(...)              (roundtrips++, XGrabKeyboard(__VA_ARGS__))
+#define XGrabPointer(...)               (roundtrips++, XGrabPointer(__VA_ARGS__))
+#define XInternAtom(...)                (roundtrips++, XInternAtom(__VA_ARGS__))
+#define XQueryPointer(...)              (roundtrips++, XQueryPointer(__VA_ARGS__))
+#define XQueryTree(...)                 (roundtrips++, XQueryTree(__VA_ARGS__))
+#define XSync(...)                      (roundtrips++, XSync(__VA_ARGS__))
+#ifdef XINERAMA
+#define XineramaIsActive(...)           (roundtrips++, XineramaIsActive(__VA_ARGS__))
+#define XineramaQueryScreens(...)       (roundtrips++, XineramaQueryScreens(__VA_ARGS__))
+#endif /* XINERAMA */
+#define XkbGetMap(...)                  (roundtrips++, XkbGetMap(__VA_ARGS__))
+#define XkbQueryExtension(...)          (roundtrips++, XkbQueryExtension(__VA_ARGS__))
+
 /* macros */
 #define BUTTONMASK                      (ButtonPressMask|ButtonReleaseMask)
 #define CLEANMASK(mask)                 (mask & ~(numlockmask|LockMask) & \
@@ -78,8 +116,29 @@
 #define WINNAMELENGTH                   256
 #define ROOTNAMELENGTH                  320 /* fake signal + status */
 #define SESSIONFILE                     "/tmp/dwm-session"
+#define JOURNALFILE                     "dwm-journal-" /* and the display, in XDG_RUNTIME_DIR */
+#define STATSFILE                       "/tmp/dwm-stats"
+#define TRACEFILE                       "/tmp/dwm-trace.json"
 #define DSBLOCKSLOCKFILE                "/var/local/dsblocks/dsblocks.pid"
 #define DELIMITERENDCHAR                10
+#define WINTABLEBITS                    6 /* initial size of the window registry */
+#define IGNORERANGES                    32 /* request ranges whose errors are ignored */
+#define MAXWATCHES                      8 /* fds polled besides the X connection */
+#define MAXTIMERS                       16 /* pending scheduled functions */
+#define PROPLENGTH                      0x1fffffff /* fetch whole text properties */
+#define OPDEPTH                         16 /* max nesting of accounted operations */
+#define EVENTBATCH                      256 /* max events drained and coalesced at once */
+#define EVKEYS                          512 /* coalescing table size, power of 2 > EVENTBATCH */
+#define REMAPSIZE                       8192 /* recorded ids a replay translates, power of 2 */
+#define HOTMAGIC                        0x686d7764 /* "dwmh", see hotsave */
+#define HOTVERSION                      2
+#define JOURNALMAGIC                    0x6a6d7764 /* "dwmj", see journalsnapshot */
+#define JOURNALVERSION                  1
+#define JOURNALBUF                      256 /* records the buffers start with */
+#define JOURNALDELAY                    1000 /* ms a change waits for its write */
+#define JOURNALMAX                      (1 << 20) /* bytes compacted into a snapshot */
+#define KEYHASHBITS                     8 /* buckets of the key dispatch table */
+#define KEYHASH(S)                      ((unsigned int)(S) * 2654435761u >> (32 - KEYHASHBITS))
 
 #define NET_WM_STATE_ADD                1
 #define NET_WM_STATE_TOGGLE             2
@@ -95,14 +154,27 @@ enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetSystemTray, NetSystemTrayOP, NetSystemTrayOrientation,
        NetSystemTrayOrientationHorz, NetWMFullscreen, NetActiveWindow,
        NetWMWindowType, NetWMWindowTypeDialog, NetDesktopNames,
-       NetWMDesktop, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMDesktop, NetClientList, NetClientListStacking, NetLast }; /* EWMH atoms */
 enum { Manager, Xembed, XembedInfo, XLast }; /* Xembed atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMWindowRole,
        WMLast }; /* default atoms */
+enum { DWMJournal, DWMLast }; /* atoms of dwm's own */
 enum { ClkTagBar, ClkTabBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
 enum { Running, Restarted, Restart, Stop }; /* runningstate */
 enum { FhintsOff, FhintsFocus, FhintsPop }; /* fhintsstate */
+enum { WinClient, WinIcon, WinBar, WinTab, WinToplevel }; /* window registry kinds */
+enum { PropNetWMName, PropWMName, PropTransient, PropClass, PropRole,
+       PropState, PropType, PropNormalHints, PropHints, PropProtocols,
+       PropLast }; /* properties requested at once by manage */
+enum { OpArrange, OpRestack, OpDrawbar, OpDrawtab, OpManage, OpUnmanage,
+       OpView, OpFocus, OpLast }; /* accounted operations */
+enum { DirtyLayout = 1 << 0, DirtyStack = 1 << 1,
+       DirtyBar = 1 << 2, DirtyTab = 1 << 3 }; /* pending frame work */
+enum { CfgResize = 1 << 0, CfgNotify = 1 << 1 }; /* pending configure requests */
+enum { ProtoTakeFocus = 1 << 0, ProtoDelete = 1 << 1 }; /* cached WM_PROTOCOLS */
+enum { GrabsNone, GrabsFocused, GrabsUnfocused }; /* button grabs in place */
+enum { JournalMon, JournalTag, JournalClient, JournalGone }; /* journal records */
 
 typedef union {
 	int i;
@@ -124,6 +196,51 @@ typedef struct {
 	float mina, maxa;
 } SizeHints;
 
+typedef struct { /* unmanaged toplevel, as its CreateNotify and ConfigureNotify say */
+        int x, y, w, h, bw;
+} Toplevel;
+
+typedef struct { /* state of a monitor as journaled, see journalsync */
+        int showbar, selected;
+        unsigned int tagset[2]; /* current first */
+        unsigned int curtag, prevtag;
+} MonState;
+
+typedef struct { /* state of a client as journaled */
+        Window win;
+        int mon; /* num */
+        unsigned int tags;
+        int isfloating, ishidden, scratchkey;
+} ClientState;
+
+typedef struct { /* state of a tag of a monitor as journaled */
+        int nmaster;
+        float mfact;
+        int showtabs;
+        unsigned int lt[2], att[2]; /* selected first */
+        int splus[2];
+} TagState;
+
+/* The journal is a JournalHead and records of fixed size, each the new state
+ * of a monitor, a tag or a client or a client gone, the last one counting. It
+ * starts with a snapshot of everything, see journalsnapshot. The token is also
+ * on the root window, a journal of another X server doesn't have it. */
+typedef struct {
+        unsigned int magic, version, recsize, ntags;
+        unsigned int token[2];
+} JournalHead;
+
+typedef struct {
+        int kind; /* Journal* */
+        int num;  /* monitor of JournalMon and JournalTag */
+        unsigned int tag; /* of JournalTag, 0 for the all tags view */
+        union {
+                MonState m;
+                TagState t;
+                ClientState c;
+        } u;
+} JournalRecord;
+
 typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
@@ -132,11 +249,22 @@ struct Client {
 	int sfx, sfy, sfw, sfh; /* stored float geometry, used on mode revert */
 	int oldx, oldy, oldw, oldh;
 	int bw, oldbw;
+        int origbw; /* border before dwm, restored by unmanageall */
 	unsigned int tags;
         int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen,
             hintsvalid, ishidden;
+        int cfgpending; /* Cfg* to answer in the next frame */
+        int titlevalid; /* name is refetched when drawn otherwise */
+        int protocols, protovalid; /* Proto*, refetched when invalid */
+        int hashints;
+        XWMHints hints; /* as last read or written, see updatewmhints */
+        int grabs; /* Grabs*, see grabbuttons */
+        long desktop, desktopsent; /* _NET_WM_DESKTOP to publish and as last written */
+        long wmstate; /* WM_STATE as last written, -1 if none */
+        long long titlelast; /* ms of the last redraw for a title change */
 	int scratchkey;
         SizeHints sh;
+        ClientState journaled;
 	Client *next;
 	Client *snext;
 	Monitor *mon;
@@ -152,6 +280,11 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+typedef struct {
+        KeyCode code;
+        unsigned int mod;
+} KeyGrab;
+
 typedef struct {
         KeySym keysym;
         const char *h;
@@ -191,6 +324,8 @@ struct Monitor {
 	int topbar;
 	int toptab;
         int statushandcursor;
+        unsigned int dirty;   /* work left for the next flush */
+        MonState journaled;
 	Client *clients;
 	Client *sel;
 	Client *stack;
@@ -215,12 +350,61 @@ typedef struct {
 	Icon *icons;
 } Systray;
 
+typedef struct Entry Entry;
+struct Entry {
+        Window win;
+        int kind;
+        void *p;
+        Entry *next;
+};
+
+typedef struct {
+        unsigned int gen; /* batch the key belongs to */
+        int type;         /* event type, 0 for barriers */
+        Window win;
+        Atom atom;
+        int idx;          /* index of the latest such event in the batch */
+} Evkey;
+
+typedef struct {
+        int fd;
+        void (*func)(int fd);
+} Watch;
+
+typedef struct {
+        xcb_get_property_cookie_t ck[PropLast];
+        char name[WINNAMELENGTH];
+        char class[256], instance[256], role[16];
+        int hastrans, hassize, hashints;
+        int protocols;
+        Window trans;
+        Atom state, wtype;
+        XSizeHints size;
+        XWMHints hints;
+} Props;
+
+typedef struct {
+        long long due; /* CLOCK_MONOTONIC, in ms */
+        void (*func)(void);
+} Timer;
+
+typedef struct {
+        unsigned int from; /* id in the trace */
+        unsigned long to;  /* id on this server */
+} Remap;
+
 /* function declarations */
 static void addsystrayicon(Icon *i);
+static int addwatch(int fd, void (*func)(int fd));
+static void applyconfigs(void);
 static void applyfribidi(char *s);
 static int applygeomhints(Client *c, int *x, int *y, int *w, int *h, int interact);
-static void applyrules(Client *c); /* defined in config.h */
+static void applyrules(Client *c, const char *class, const char *instance,
+                const char *role); /* defined in config.h */
 static void applysizehints(SizeHints *sh, int *w, int *h);
+static void applytitle(Client *c);
+static void applytitles(void);
+static void applywindowtype(Client *c, Atom state, Atom wtype, int new);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
@@ -235,10 +419,16 @@ static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void cleanupsystray(void);
 static void clientmessage(XEvent *e);
+static int cmpclientrecords(const void *a, const void *b);
+static int cmpkeygrabs(const void *a, const void *b);
+static void coalesce(XEvent *evs, int i, unsigned int gen);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
 static Monitor *createmon(void);
+static void createnotify(XEvent *e);
+static int decodetextprop(XTextProperty *name, char *text, unsigned int size);
+static void delwatch(int fd);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
@@ -251,10 +441,13 @@ static void drawstatus(void);
 static void drawtab(Monitor *m);
 static void drawtabhelper(Monitor *m, int onlystack);
 static void drawtabs(void);
+static void dumpstats(const Arg *arg);
 //static void enternotify(XEvent *e);
+static Evkey *evkey(int type, Window w, Atom a, unsigned int gen);
 static void expose(XEvent *e);
 static Client *fhintsclient(int idx);
 static void fhintsmode(const Arg *arg);
+static void flush(void);
 static void focus(Client *c);
 static void focusalt(Client *c, int doarrange);
 static void focusclient(Client *c, unsigned int tag);
@@ -266,61 +459,108 @@ static void focuslastvisible(const Arg *arg);
 static void focustiled(const Arg *arg);
 static void focuswin(const Arg* arg);
 static Atom getatomprop(Client *c, Atom prop);
+static long long getms(void);
 static int getrootptr(int *x, int *y);
-static int getwinptr(Window w, int *x, int *y);
-static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static long getxembedflags(Window w);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
+static int hasprotocol(Client *c, int proto);
+static void hashkeys(void);
+static int hotrestore(int fd);
+static int hotsave(void);
+static void ignorebegin(void);
+static void ignoreend(void);
 static void incnmaster(const Arg *arg);
 static void initsystray(void);
+static void journalappend(const JournalRecord *r);
+static void journaldiff(int all);
+static void journalpost(const JournalHead *snapshot);
+static int journalput(int fd, const void *data, size_t size);
+static void journalreplay(void);
+static void journalsnapshot(void);
+static void journalstop(int clean);
+static void journalsync(void);
+static int journaltoken(unsigned int token[2]);
+static void *journalwork(void *arg);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
 static void manage(Window w, XWindowAttributes *wa);
+static Client *managehelper(Window w, XWindowAttributes *wa, Props *p);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
+static void maskevent(long mask, XEvent *ev);
 static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
 static Client *nexttiled(Client *c);
+static void opbegin(int op);
+static void opend(void);
 static void pop(Client *c);
 static void propertynotify(XEvent *e);
+static void publishdesktops(void);
+static int protomask(Atom a);
+static void queueconfig(Client *c, int what);
+static void queuetitle(Client *c);
 static void quit(const Arg *arg);
+static void readsignals(int fd);
+static void readtimers(int fd);
+static void receiveprops(Props *p);
+static void record(const char *path);
 static Monitor *recttomon(int x, int y, int w, int h);
+static Remap *remap(Remap *t, unsigned int from);
 static void removesystrayicon(Icon *i);
+static void renderbar(Monitor *m);
+static void rendertab(Monitor *m);
 static void reparentnotify(XEvent *e);
+static void replay(const char *path);
+static Atom replayatom(unsigned int a);
+static void replayevent(XEvent *ev);
+static void replayprop(RecPropData *d);
+static int replayread(XEvent *ev);
+static Window replaywin(unsigned int w);
+static int replytext(xcb_get_property_reply_t *r, char *text, unsigned int size);
+static void requestprops(Window w, Props *p);
 static void resetsplus(const Arg *arg);
+static void resetstats(const Arg *arg);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
+static void restackmon(Monitor *m);
 static void restoresession(void);
 static void restorestatus(void);
 static void run(void);
 static void savesession(void);
 static void scan(void);
+static void schedule(int ms, void (*func)(void));
 static void scratchhidehelper(void);
 static int scratchshowhelper(int key);
-static int sendevent(Window w, Atom proto, int m, long d0, long d1, long d2, long d3, long d4);
+static void sendevent(Window w, Atom proto, int m, long d0, long d1, long d2, long d3, long d4);
 static void sendmon(Client *c, Monitor *m);
+static void setactivewindow(Window w);
 static void setattach(const Arg *arg);
 static void setattorprev(const Arg *arg);
+static void setclientdesktop(Client *c, long desktop);
 static void setclientstate(Client *c, long state);
 static void setdesktopnames(void);
 static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
+static void setgeomhints(Client *c, XSizeHints *size);
 static void setlayout(const Arg *arg);
 static void setltorprev(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setsizehints(SizeHints *sh, XSizeHints *size);
 static void setsplus(const Arg *arg);
 static void setup(void);
 static void seturgent(Client *c, int urg);
+static void setwmhints(Client *c, XWMHints *wmh);
 static void shifttag(const Arg *arg);
 static void shiftview(const Arg *arg);
 static void showhide(Client *c);
 static void sigdsblocks(const Arg *arg);
 static void spawn(const Arg *arg);
+static Window *stacklineup(int *n);
 static void swaptags(const Arg *arg);
 static void tabmode(const Arg *arg);
 static void tag(const Arg *arg);
@@ -335,19 +575,27 @@ static void tiledeckver(Monitor *m, int deck);
 static void togglebar(const Arg *arg);
 static void togglefloating(const Arg *arg);
 static void toggletag(const Arg *arg);
+static void toggletrace(const Arg *arg);
 static void toggleview(const Arg *arg);
 static void togglewin(const Arg *arg);
+static void trackpointer(XEvent *e);
 static void unfocus(Client *c);
 static int unhideifhidden(Client *c, unsigned int tag);
 static void unmanage(Client *c, int destroyed);
+static void unmanageall(void);
 static void unmapnotify(XEvent *e);
+static void unschedule(void (*func)(void));
 static void updatebarpos(Monitor *m);
 static void updatebars(void);
+static void updatebuttongrabs(void);
 static void updateclientdesktop(Client *c, unsigned int tag);
 static void updateclientlist(void);
+static void updateclientstacking(void);
 static void updatedsblockssig(int x);
 static int updategeom(void);
 static void updategeomhints(Client *c);
+static void updategrabs(void);
+static void updatekeymap(void);
 static void updatentiles(Monitor *m);
 static void updatenumlockmask(void);
 static void updatepertag(void);
@@ -359,16 +607,21 @@ static void updatesystray(void);
 static int updatesystrayicongeom(Icon *i, int w, int h);
 static void updatesystrayiconstate(Icon *i, XPropertyEvent *ev);
 static void updatesystraymon();
+static void updatetimer(void);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c, int new);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
+static void winadd(Window w, int kind, void *p);
+static void windel(Window w);
+static Entry *winentry(Window w);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static Icon *wintosystrayicon(Window w);
+static void writestats(FILE *fp);
 static int xerror(Display *dpy, XErrorEvent *ee);
-static int xerrordummy(Display *dpy, XErrorEvent *ee);
 static int xerrorstart(Display *dpy, XErrorEvent *ee);
+static void xkbnotify(XEvent *e);
 static void zoom(const Arg *arg);
 
 /* variables */
@@ -387,11 +640,14 @@ static int fhintsstate = FhintsOff;
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int dsblockssig;
 static unsigned int numlockmask = 0;
+static int xkbevent; /* event type of XKB, 0 without it */
+static int ptrx, ptry, ptrvalid; /* pointer position of the event at hand */
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
 	[ClientMessage] = clientmessage,
 	[ConfigureRequest] = configurerequest,
 	[ConfigureNotify] = configurenotify,
+        [CreateNotify] = createnotify,
 	[DestroyNotify] = destroynotify,
 //	[EnterNotify] = enternotify,
 	[Expose] = expose,
@@ -404,14 +660,84 @@ static void (*handler[LASTEvent]) (XEvent *) = {
         [ReparentNotify] = reparentnotify,
 	[UnmapNotify] = unmapnotify
 };
-static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast];
+static Hist evstats[LASTEvent] = { /* handler latencies */
+	[ButtonPress] = { "ButtonPress" },
+	[ClientMessage] = { "ClientMessage" },
+	[ConfigureRequest] = { "ConfigureRequest" },
+	[ConfigureNotify] = { "ConfigureNotify" },
+        [CreateNotify] = { "CreateNotify" },
+	[DestroyNotify] = { "DestroyNotify" },
+	[Expose] = { "Expose" },
+	[FocusIn] = { "FocusIn" },
+	[KeyPress] = { "KeyPress" },
+	[MappingNotify] = { "MappingNotify" },
+	[MapRequest] = { "MapRequest" },
+	[MotionNotify] = { "MotionNotify" },
+	[PropertyNotify] = { "PropertyNotify" },
+        [ReparentNotify] = { "ReparentNotify" },
+	[UnmapNotify] = { "UnmapNotify" },
+};
+static Hist opstats[OpLast] = {
+        [OpArrange] = { "arrange" },
+        [OpRestack] = { "restack" },
+        [OpDrawbar] = { "drawbar" },
+        [OpDrawtab] = { "drawtab" },
+        [OpManage] = { "manage" },
+        [OpUnmanage] = { "unmanage" },
+        [OpView] = { "view" },
+        [OpFocus] = { "focus" },
+};
+static struct { unsigned long calls, roundtrips, requests; } opreqs[OpLast];
+static struct { int op; unsigned long long t0; unsigned long rt, req; } opstack[OPDEPTH];
+static int opdepth;
+static unsigned long roundtrips; /* replies waited for so far */
+static unsigned long evcoalesced; /* events dropped as superseded */
+static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast], dwmatom[DWMLast];
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
+static xcb_connection_t *xcon;   /* same connection, for pipelined requests */
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Systray *systray;
 static Window root, wmcheckwin;
+static Window activewin;         /* _NET_ACTIVE_WINDOW as last written */
+static int desktopsdirty;        /* some _NET_WM_DESKTOP to publish, see flush */
+static int hotfd = -1;           /* state handed over by a hot restart */
+static int journaling;           /* session journal kept, see journalsync */
+static char journalpath[256];    /* empty without XDG_RUNTIME_DIR */
+static char journalnew[sizeof journalpath + 4];
+static unsigned int journalid[2]; /* token of this X server, see journaltoken */
+static size_t journalsize;       /* bytes handed over since the last snapshot */
+static JournalRecord *journalbuf;
+static size_t njournal, journalcap; /* records in journalbuf and room for */
+static int journalfd = -1;       /* of the journal worker only */
+static pthread_t journalthread;
+static struct {                  /* handed over to the journal worker */
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        JournalRecord *recs;
+        size_t n, cap;
+        JournalHead head;        /* of a snapshot */
+        int snapshot, quit, failed;
+} journalq = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static int stackingdirty;        /* the stack lists changed, see flush */
+static int stackinglineup;       /* _NET_CLIENT_LIST_STACKING holds another lineup */
+static Entry **wintable;         /* window registry, hashed by window id */
+static unsigned int wintablebits, wintablecount;
+static struct { unsigned long start, end; } ignores[IGNORERANGES]; /* ring */
+static unsigned int ignorehead, ignorecount;
+static Watch watches[MAXWATCHES];
+static Timer timers[MAXTIMERS];
+static int nwatches, ntimers;
+static int sigfd = -1, timerfd = -1;
+static long long cfgdue, cfglast; /* next and last frame of configure answers, ms */
+static long long titledue;        /* next frame of throttled title redraws, ms */
+static int recording;           /* events go to the trace, see record */
+static FILE *replayfp;          /* trace being replayed, see replay */
+static int replayback = -1;     /* kind of the record replayev was pushed back from */
+static XEvent replayev;
+static Remap rwins[REMAPSIZE], ratoms[REMAPSIZE];
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
@@ -427,11 +753,54 @@ struct Pertag {
         unsigned int attidxs[LENGTH(tags) + 1][2]; /* matrix of attach position indexes per tag */
         int showtabs[LENGTH(tags) + 1]; /* display tab per tag */
         int splus[LENGTH(tags) + 1][2]; /* extra size per tag: first master and first stack */
+        TagState journaled[LENGTH(tags) + 1];
 };
 
 /* compile-time check if all tags fit into an unsigned int bit array. */
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
+/* The blob of a hot restart is a HotHead, its monitors, the clients of each
+ * monitor in order and then the windows of each monitor's stack, see hotsave.
+ * A dwm whose sizes or counts differ doesn't read it. */
+typedef struct {
+        unsigned int magic, version;
+        unsigned int monsize, clientsize, ntags, nlayouts, nattachs;
+        unsigned int nmons, nclients;
+        int selmon; /* num */
+} HotHead;
+
+typedef struct {
+        int num, showbar, nclients;
+        unsigned int seltags, sellt, tagset[2];
+        Window sel;
+        Pertag pertag;
+} HotMon;
+
+typedef struct {
+        Window win;
+        char name[WINNAMELENGTH];
+        int x, y, w, h, sfx, sfy, sfw, sfh, oldx, oldy, oldw, oldh, bw, oldbw, origbw;
+        unsigned int tags;
+        int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen,
+            hintsvalid, ishidden;
+        int protocols, protovalid, hashints, scratchkey;
+        long desktop, desktopsent;
+        XWMHints hints;
+        SizeHints sh;
+} HotClient;
+
+/* button grabs of focused clients, see updatebuttongrabs */
+static struct { unsigned int button, mod; } buttongrabs[LENGTH(buttons) * 4];
+static int nbuttongrabs;
+
+/* keys[] by keysym, see hashkeys; the keyboard mapping and the key grabs it
+ * resulted in, see updatekeymap and grabkeys */
+static int keyhash[1 << KEYHASHBITS]; /* 1 + index of the first key, 0 if none */
+static int keynext[LENGTH(keys)]; /* 1 + index of the next key in the bucket */
+static KeySym keysyms[256]; /* unshifted keysym of each keycode */
+static KeyGrab *keygrabs;
+static int nkeygrabs;
+
 /* function implementations */
 void
 addsystrayicon(Icon *i)
@@ -445,6 +814,7 @@ addsystrayicon(Icon *i)
         }
         i->next = systray->icons;
         systray->icons = i;
+        winadd(i->win, WinIcon, i);
         updatesizehints(i->win, &i->sh);
         updatesystrayicongeom(i, wa.width, wa.height);
         XSelectInput(dpy, i->win, PropertyChangeMask);
@@ -452,7 +822,6 @@ addsystrayicon(Icon *i)
         XReparentWindow(dpy, i->win, systray->win, 0, 0);
         sendevent(i->win, netatom[Xembed], NoEventMask, CurrentTime,
                   XEMBED_EMBEDDED_NOTIFY, 0, systray->win, XEMBED_EMBEDDED_VERSION);
-        XSync(dpy, False);
         i->ismapped = !(flags = getxembedflags(i->win)) || flags & XEMBED_MAPPED;
         if (i->ismapped) {
                 updatesystray();
@@ -460,6 +829,39 @@ addsystrayicon(Icon *i)
         }
 }
 
+/* Registers func to be called from the event loop whenever fd is readable. */
+int
+addwatch(int fd, void (*func)(int fd))
+{
+        if (nwatches == MAXWATCHES)
+                return 0;
+        watches[nwatches].fd = fd;
+        watches[nwatches++].func = func;
+        return 1;
+}
+
+/* Answers the configure requests gathered since the last frame, with the
+ * latest geometry each client asked for. */
+void
+applyconfigs(void)
+{
+        TRACE_FUNC();
+
+        cfgdue = 0;
+        cfglast = getms();
+        unschedule(applyconfigs);
+        for (Monitor *m = mons; m; m = m->next)
+                for (Client *c = m->clients; c; c = c->next) {
+                        if (!c->cfgpending)
+                                continue;
+                        if (c->cfgpending & CfgResize && ISVISIBLE(c))
+                                XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+                        if (c->cfgpending & CfgNotify)
+                                configure(c);
+                        c->cfgpending = 0;
+                }
+}
+
 void
 applyfribidi(char *s)
 {
@@ -550,23 +952,69 @@ applysizehints(SizeHints *sh, int *w, int *h)
                 *h = MIN(*h, sh->maxh);
 }
 
+void
+applytitle(Client *c)
+{
+	if (c->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(c->name, broken);
+	applyfribidi(c->name);
+        c->titlevalid = 1;
+}
+
+/* Redraws the titles throttled by queuetitle, refetching them on the way. */
+void
+applytitles(void)
+{
+        long long now = getms();
+
+        titledue = 0;
+        unschedule(applytitles);
+        for (Monitor *m = mons; m; m = m->next)
+                for (Client *c = m->clients; c; c = c->next)
+                        if (!c->titlevalid && ISVISIBLE(c)) {
+                                c->titlelast = now;
+                                if (c == m->sel)
+                                        drawbar(m);
+                                drawtab(m);
+                        }
+}
+
+void
+applywindowtype(Client *c, Atom state, Atom wtype, int new)
+{
+	if (state == netatom[NetWMFullscreen])
+		setfullscreen(c, 1);
+	if (wtype == netatom[NetWMWindowTypeDialog]) {
+                c->isfloating = new ? 1 : -1;
+                c->bw = 0;
+        }
+}
+
+/* Schedules m (all monitors if NULL) to be laid out by the next flush. The
+ * tile count and bar positions are kept current right away, handlers later in
+ * the same batch rely on them. */
 void
 arrange(Monitor *m)
 {
+        TRACE_FUNC();
+
 	if (m) {
-		showhide(m->stack);
-		arrangemon(m);
-                restack(m);
+                updatentiles(m);
+                updatebarpos(m);
+                m->dirty |= DirtyLayout|DirtyStack|DirtyBar|DirtyTab;
         } else
                 for (m = mons; m; m = m->next) {
-		        showhide(m->stack);
-		        arrangemon(m);
+                        updatentiles(m);
+                        updatebarpos(m);
+                        m->dirty |= DirtyLayout;
                 }
 }
 
 void
 arrangemon(Monitor *m)
 {
+        TRACE_FUNC();
+
         updatentiles(m);
 	updatebarpos(m);
 	XMoveResizeWindow(dpy, m->tabwin, m->wx, m->ty, m->ww, th);
@@ -660,11 +1108,13 @@ attachstack(Client *c)
 {
 	c->snext = c->mon->stack;
 	c->mon->stack = c;
+        stackingdirty = 1;
 }
 
 void
 buttonpress(XEvent *e)
 {
+        TRACE_FUNC();
         int i, x;
         int dirty = 0;
         unsigned int click;
@@ -679,6 +1129,7 @@ buttonpress(XEvent *e)
 		unfocus(selmon->sel);
                 updateselmon(m);
 		focus(NULL);
+                flush(); /* ble and blw are those of the new selmon's bar */
 	}
 	if (ev->window == selmon->barwin) {
                 if (ev->x < ble - blw) {
@@ -722,8 +1173,14 @@ buttonpress(XEvent *e)
                 arg.i = i + ofst;
         } else if ((c = wintoclient(ev->window))) {
                 focusalt(c, 0); /* focus has been already shifted to the monitor of c */
-		XAllowEvents(dpy, ReplayPointer, CurrentTime);
 		click = ClkClientWin;
+                for (i = 0; i < LENGTH(buttons); i++)
+                        if ((buttons[i].click == click || buttons[i].click == ClkLast)
+                        && buttons[i].func && buttons[i].button == ev->button
+                        && CLEANMASK(buttons[i].mask) == CLEANMASK(ev->state))
+                                break;
+                /* the catch-all grab of unfocused clients caught bound clicks too */
+		XAllowEvents(dpy, i < LENGTH(buttons) ? AsyncPointer : ReplayPointer, CurrentTime);
         } else
                 click = ClkRootWin;
 	for (i = 0; i < LENGTH(buttons); i++)
@@ -749,33 +1206,24 @@ checkotherwm(void)
 void
 cleanup(void)
 {
-        int nwins;
-        Client *c;
 	Monitor *m;
-        Window *wins;
 	size_t i;
 
-        nwins = 0;
-        for (m = mons; m; m = m->next) {
-                m->tagset[0] = m->tagset[1] = TAGMASK;
-                m->lt[0] = m->lt[1] = &layouts[1];
-                strncpy(m->ltsymbol, layouts[1].symbol, sizeof m->ltsymbol - 1);
-                selmon = m;
-                focus(NULL);
-                arrange(selmon);
-                for (c = m->clients; c; c = c->next, nwins++);
-        }
-        wins = ecalloc(nwins, sizeof(Window));
-        nwins = 0;
-        for (m = mons; m; m = m->next) {
-                for (c = m->clients; c; c = c->next)
-                        wins[nwins++] = c->win;
-                while (m->stack)
-                        unmanage(m->stack, 0);
+        /* a hot restart takes the clients over as they are */
+        if (hotfd < 0) {
+                for (m = mons; m; m = m->next) {
+                        m->tagset[0] = m->tagset[1] = TAGMASK;
+                        m->lt[0] = m->lt[1] = &layouts[1];
+                        strncpy(m->ltsymbol, layouts[1].symbol, sizeof m->ltsymbol - 1);
+                        selmon = m;
+                        focus(NULL);
+                        arrange(selmon);
+                }
+                flush();
+                unmanageall();
         }
-        XRestackWindows(dpy, wins, nwins);
-        free(wins);
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
+        free(keygrabs);
 	while (mons)
 		cleanupmon(mons);
         if (systray)
@@ -785,8 +1233,16 @@ cleanup(void)
 	for (i = 0; i < LENGTH(colors); i++)
 		drw_scm_free(drw, scheme[i], 3);
 	free(scheme);
+        free(wintable);
 	XDestroyWindow(dpy, wmcheckwin);
 	drw_free(drw);
+        /* the signals stay blocked, a restarted dwm picks pending ones up */
+        journalstop(1);
+        delwatch(timerfd);
+        delwatch(sigfd);
+        close(timerfd);
+        close(sigfd);
+        rec_stop();
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
@@ -803,6 +1259,8 @@ cleanupmon(Monitor *mon)
                 for (m = mons; m->next != mon; m = m->next);
 		m->next = mon->next;
 	}
+	windel(mon->barwin);
+	windel(mon->tabwin);
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
 	XUnmapWindow(dpy, mon->tabwin);
@@ -818,6 +1276,7 @@ cleanupsystray(void)
 
         XSelectInput(dpy, systray->win, NoEventMask);
         while ((i = systray->icons)) {
+                windel(i->win);
                 XSelectInput(dpy, i->win, NoEventMask);
                 XUnmapWindow(dpy, i->win);
                 XReparentWindow(dpy, i->win, root, 0, 0);
@@ -834,12 +1293,14 @@ cleanupsystray(void)
 void
 clientmessage(XEvent *e)
 {
+        TRACE_FUNC();
 	Client *c;
         Icon *i;
 	XClientMessageEvent *cme = &e->xclient;
 
         if (systray && cme->window == systray->win) {
-                if (cme->data.l[1] == SYSTEM_TRAY_REQUEST_DOCK) {
+                if (cme->data.l[1] == SYSTEM_TRAY_REQUEST_DOCK &&
+                    !wintosystrayicon(cme->data.l[2])) {
                         i = ecalloc(1, sizeof(Icon));
                         i->win = cme->data.l[2];
                         addsystrayicon(i);
@@ -874,6 +1335,104 @@ clientmessage(XEvent *e)
 */
 }
 
+int
+cmpclientrecords(const void *a, const void *b)
+{
+        const JournalRecord *x = a, *y = b;
+
+        if (x->u.c.win != y->u.c.win)
+                return x->u.c.win < y->u.c.win ? -1 : 1;
+        return x->num - y->num;
+}
+
+int
+cmpkeygrabs(const void *a, const void *b)
+{
+        const KeyGrab *x = a, *y = b;
+
+        if (x->code != y->code)
+                return x->code < y->code ? -1 : 1;
+        return x->mod < y->mod ? -1 : x->mod > y->mod;
+}
+
+/* Drops events superseded by evs[i] within the current batch: the last
+ * PropertyNotify per window and atom (which also covers the root WM_NAME), the
+ * last ConfigureRequest per window and the last MotionNotify per window are
+ * the only ones dispatched. Handlers read the current property value anyway, so
+ * nothing is lost. Events which change what a window is to us (MapRequest,
+ * UnmapNotify, DestroyNotify, ReparentNotify) act as barriers, events before
+ * them are never dropped in favour of events after them. */
+void
+coalesce(XEvent *evs, int i, unsigned int gen)
+{
+        int j, type = evs[i].type;
+        Window w;
+        Atom a = None;
+        Evkey *k, *b;
+
+        switch (type) {
+        case PropertyNotify:
+                w = evs[i].xproperty.window;
+                a = evs[i].xproperty.atom;
+                break;
+        case ConfigureRequest:
+                w = evs[i].xconfigurerequest.window;
+                break;
+        case MotionNotify:
+                w = evs[i].xmotion.window;
+                break;
+        case MapRequest:
+        case UnmapNotify:
+        case DestroyNotify:
+        case ReparentNotify:
+                k = evkey(0, type == MapRequest ? evs[i].xmaprequest.window :
+                             type == UnmapNotify ? evs[i].xunmap.window :
+                             type == DestroyNotify ? evs[i].xdestroywindow.window :
+                                                     evs[i].xreparent.window, None, gen);
+                k->gen = gen;
+                k->idx = i;
+                return;
+        default:
+                return;
+        }
+        k = evkey(type, w, a, gen);
+        if (k->gen == gen) {
+                j = k->idx;
+                b = evkey(0, w, None, gen);
+                if (b->gen != gen || b->idx < j) {
+                        if (type == ConfigureRequest) {
+                                XConfigureRequestEvent *o = &evs[j].xconfigurerequest;
+                                XConfigureRequestEvent *n = &evs[i].xconfigurerequest;
+                                unsigned long m = o->value_mask & ~n->value_mask;
+
+                                /* keep values only the superseded request asked for */
+                                if (m & CWX)
+                                        n->x = o->x;
+                                if (m & CWY)
+                                        n->y = o->y;
+                                if (m & CWWidth)
+                                        n->width = o->width;
+                                if (m & CWHeight)
+                                        n->height = o->height;
+                                if (m & CWBorderWidth)
+                                        n->border_width = o->border_width;
+                                if (m & CWSibling)
+                                        n->above = o->above;
+                                if (m & CWStackMode)
+                                        n->detail = o->detail;
+                                n->value_mask |= m;
+                        }
+                        evs[j].type = 0; /* no handler */
+                        evcoalesced++;
+                }
+        }
+        k->gen = gen;
+        k->type = type;
+        k->win = w;
+        k->atom = a;
+        k->idx = i;
+}
+
 void
 configure(Client *c)
 {
@@ -900,7 +1459,10 @@ configurenotify(XEvent *e)
 	Client *c;
 	XConfigureEvent *ev = &e->xconfigure;
 	int dirty;
+        Entry *r;
 
+        if ((r = winentry(ev->window)) && r->kind == WinToplevel)
+                *(Toplevel *)r->p = (Toplevel){ ev->x, ev->y, ev->width, ev->height, ev->border_width };
 	/* TODO: updategeom handling sucks, needs to be simplified */
 	if (ev->window == root) {
 		dirty = (sw != ev->width || sh != ev->height);
@@ -924,8 +1486,11 @@ configurenotify(XEvent *e)
 void
 configurerequest(XEvent *e)
 {
+        TRACE_FUNC();
 	Client *c;
         Icon *i;
+        Entry *r;
+        Toplevel *t;
 	XConfigureRequestEvent *ev = &e->xconfigurerequest;
 	XWindowChanges wc;
 
@@ -954,11 +1519,11 @@ configurerequest(XEvent *e)
 			if ((c->y + c->h) > selmon->my + selmon->mh && c->isfloating)
 				c->y = selmon->my + (selmon->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
-				configure(c);
-			if (ISVISIBLE(c))
-				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+				queueconfig(c, CfgResize|CfgNotify);
+                        else
+                                queueconfig(c, CfgResize);
 		} else
-			configure(c);
+			queueconfig(c, CfgNotify);
         } else if ((i = wintosystrayicon(ev->window))) {
                 if (ev->value_mask & (CWWidth|CWHeight) &&
                     updatesystrayicongeom(i, ev->width, ev->height) && i->ismapped) {
@@ -973,8 +1538,21 @@ configurerequest(XEvent *e)
 		wc.sibling = ev->above;
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
+                /* a MapRequest right after comes before the ConfigureNotify */
+                if ((r = winentry(ev->window)) && r->kind == WinToplevel) {
+                        t = r->p;
+                        if (ev->value_mask & CWX)
+                                t->x = ev->x;
+                        if (ev->value_mask & CWY)
+                                t->y = ev->y;
+                        if (ev->value_mask & CWWidth)
+                                t->w = ev->width;
+                        if (ev->value_mask & CWHeight)
+                                t->h = ev->height;
+                        if (ev->value_mask & CWBorderWidth)
+                                t->bw = ev->border_width;
+                }
 	}
-	XSync(dpy, False);
 }
 
 Monitor *
@@ -1010,17 +1588,65 @@ createmon(void)
 	return m;
 }
 
+/* Remembers the geometry of new toplevels, so that maprequest needn't ask for
+ * it. Override-redirect windows never get managed, so they are left out. */
+void
+createnotify(XEvent *e)
+{
+        XCreateWindowEvent *ev = &e->xcreatewindow;
+        Toplevel *t;
+
+        if (ev->parent != root || ev->override_redirect || winentry(ev->window))
+                return;
+        t = ecalloc(1, sizeof(Toplevel));
+        *t = (Toplevel){ ev->x, ev->y, ev->width, ev->height, ev->border_width };
+        winadd(ev->window, WinToplevel, t);
+}
+
+/* text must have room for size bytes, name->value is left to the caller */
+int
+decodetextprop(XTextProperty *name, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n;
+
+        if (!name->nitems)
+                return 0;
+	if (name->encoding == XA_STRING) {
+		strncpy(text, (char *)name->value, size - 1);
+	} else if (XmbTextPropertyToTextList(dpy, name, &list, &n) >= Success && n > 0 && *list) {
+		strncpy(text, *list, size - 1);
+		XFreeStringList(list);
+	}
+	text[size - 1] = '\0';
+	return 1;
+}
+
+void
+delwatch(int fd)
+{
+        for (int i = 0; i < nwatches; i++)
+                if (watches[i].fd == fd) {
+                        watches[i] = watches[--nwatches];
+                        return;
+                }
+}
+
 void
 destroynotify(XEvent *e)
 {
 	Client *c;
         Icon *i;
+        Entry *r;
 	XDestroyWindowEvent *ev = &e->xdestroywindow;
 
 	if ((c = wintoclient(ev->window))) {
 		unmanage(c, 1);
         } else if ((i = wintosystrayicon(ev->window))) {
                 removesystrayicon(i);
+        } else if ((r = winentry(ev->window)) && r->kind == WinToplevel) {
+                free(r->p);
+                windel(ev->window);
         }
 }
 
@@ -1040,6 +1666,7 @@ detachstack(Client *c)
 
 	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext);
 	*tc = c->snext;
+        stackingdirty = 1;
 
 	if (c == c->mon->sel) {
 		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext);
@@ -1068,6 +1695,20 @@ dirtomon(int dir)
 void
 drawbar(Monitor *m)
 {
+        m->dirty |= DirtyBar;
+}
+
+void
+drawbars(void)
+{
+	for (Monitor *m = mons; m; m = m->next)
+		m->dirty |= DirtyBar;
+}
+
+void
+renderbar(Monitor *m)
+{
+        TRACE_FUNC();
 	int x, w;
 	int boxs = drw->fonts->h / 9;
 	int boxw = drw->fonts->h / 6 + 2;
@@ -1121,6 +1762,8 @@ drawbar(Monitor *m)
 
         drw_setscheme(drw, scheme[SchemeNorm]);
         if (m->sel && w > lrpad) {
+                if (!m->sel->titlevalid)
+                        updatetitle(m->sel);
                 /* lrpad / 2 below for padding */
                 w = drw_text(drw, x, 0, w - lrpad / 2, bh, lrpad / 2, m->sel->name, 0);
                 if (m->sel->isfloating)
@@ -1133,13 +1776,6 @@ drawbar(Monitor *m)
 	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
 }
 
-void
-drawbars(void)
-{
-	for (Monitor *m = mons; m; m = m->next)
-		drawbar(m);
-}
-
 void
 drawfhints(void)
 {
@@ -1214,6 +1850,14 @@ drawstatus(void)
 void
 drawtab(Monitor *m)
 {
+        m->dirty |= DirtyTab;
+}
+
+void
+rendertab(Monitor *m)
+{
+        TRACE_FUNC();
+
         if (m->pertag->showtabs[m->pertag->curtag] == ShowtabAlways) {
                 updatentiles(m);
                 if (m->ntiles == 0) {
@@ -1256,6 +1900,8 @@ drawtabhelper(Monitor *m, int onlystack)
                 drw_setscheme(drw, scheme[c->isurgent ? SchemeUrg :
                                           c == selmon->sel ? SchemeSel :
                                           i % 2 == 0 ? SchemeNorm : SchemeStts]);
+                if (!c->titlevalid)
+                        updatetitle(c);
                 /* lrpad/2 below for padding */
                 x = drw_text(drw, x, 0, (i < lft ? tbw+1 : tbw) - lrpad/2, th, lrpad/2, c->name, 0);
                 drw_rect(drw, x, 0, lrpad/2, th, 1, 1); x += lrpad/2; /* clear right padding */
@@ -1271,7 +1917,22 @@ drawtabhelper(Monitor *m, int onlystack)
 void
 drawtabs(void) {
 	for (Monitor *m = mons; m; m = m->next)
-                drawtab(m);
+                m->dirty |= DirtyTab;
+}
+
+/* Writes the latency histograms to STATSFILE. */
+void
+dumpstats(const Arg *arg)
+{
+        FILE *fp = fopen(STATSFILE, "w");
+
+        if (!fp) {
+                fputs("dwm: failed to open statsfile for writing\n", stderr);
+                return;
+        }
+        writestats(fp);
+        if (fclose(fp) != 0)
+                fputs("dwm: dumpstats: failed to close statsfile\n", stderr);
 }
 
 /*
@@ -1289,7 +1950,7 @@ enternotify(XEvent *e)
 	if (m != selmon) {
 		unfocus(selmon->sel);
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		setactivewindow(None);
                 updateselmon(m);
 	} else if (!c || c == selmon->sel) {
 		return;
@@ -1298,21 +1959,39 @@ enternotify(XEvent *e)
 }
 */
 
+/* returns the slot of the key in the coalescing table, which is a free one
+ * (with a stale gen) if the key hasn't been seen in this batch */
+Evkey *
+evkey(int type, Window w, Atom a, unsigned int gen)
+{
+        static Evkey keys[EVKEYS];
+        unsigned int h;
+
+        h = (unsigned int)((w * 2654435761u) ^ (a * 40503u) ^ type) & (EVKEYS - 1);
+        while (keys[h].gen == gen &&
+               (keys[h].type != type || keys[h].win != w || keys[h].atom != a))
+                h = (h + 1) & (EVKEYS - 1);
+        if (keys[h].gen != gen) { /* claim */
+                keys[h].type = type;
+                keys[h].win = w;
+                keys[h].atom = a;
+        }
+        return &keys[h];
+}
+
 void
 expose(XEvent *e)
 {
+        Entry *r;
 	XExposeEvent *ev = &e->xexpose;
 
-        if (ev->count != 0)
+        if (ev->count != 0 || !(r = winentry(ev->window)))
                 return;
-	for (Monitor *m = mons; m; m = m->next)
-                if (ev->window == m->barwin) {
-                        drawbar(m);
-                        return;
-                } else if (ev->window == m->tabwin) {
-                        drawtab(m);
-                        return;
-                }
+        if (r->kind == WinBar) {
+                drawbar(r->p);
+        } else if (r->kind == WinTab) {
+                drawtab(r->p);
+        }
 }
 
 Client *
@@ -1338,14 +2017,76 @@ fhintsmode(const Arg *arg)
                         c->hidx = i;
                 }
         fhintsstate = arg->i ? FhintsPop : FhintsFocus;
-        grabkeys();
+	XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
         drawfhints();
         drawtab(selmon);
 }
 
+/* Does the work arrange, restack, drawbar and drawtab scheduled since the last
+ * call, at most once per monitor. */
+void
+flush(void)
+{
+        TRACE_FUNC();
+        int restacked = 0;
+        unsigned int dirty;
+        XEvent ev;
+
+        /* the timers may be starved while events keep coming */
+        if (cfgdue || titledue) {
+                long long now = getms();
+
+                if (cfgdue && now >= cfgdue)
+                        applyconfigs();
+                if (titledue && now >= titledue)
+                        applytitles();
+        }
+        for (Monitor *m = mons; m; m = m->next) {
+                if (!(dirty = m->dirty))
+                        continue;
+                m->dirty = 0;
+                if (dirty & DirtyLayout) {
+                        opbegin(OpArrange);
+                        showhide(m->stack);
+                        arrangemon(m);
+                        opend();
+                }
+                if (dirty & DirtyBar) {
+                        opbegin(OpDrawbar);
+                        renderbar(m);
+                        opend();
+                }
+                if (dirty & DirtyTab) {
+                        opbegin(OpDrawtab);
+                        rendertab(m);
+                        opend();
+                }
+                if (dirty & DirtyStack) {
+                        opbegin(OpRestack);
+                        restackmon(m);
+                        opend();
+                        restacked = 1;
+                }
+        }
+        if (desktopsdirty) {
+                desktopsdirty = 0;
+                publishdesktops();
+        }
+        if (stackingdirty)
+                updateclientstacking();
+        if (journaling)
+                schedule(JOURNALDELAY, journalsync);
+        /* drop crossing events already caused by restacking, without waiting */
+        if (restacked)
+                while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+}
+
 void
 focus(Client *c)
 {
+        TRACE_FUNC();
+
+        opbegin(OpFocus);
 	if (!c || !ISVISIBLE(c))
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
 	if (selmon->sel && selmon->sel != c)
@@ -1362,11 +2103,12 @@ focus(Client *c)
 		setfocus(c);
 	} else {
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		setactivewindow(None);
 	}
 	selmon->sel = c;
 	drawbars();
 	drawtabs();
+        opend();
 }
 
 /* c must be non-NULL, on selmon and VISIBLE */
@@ -1543,50 +2285,35 @@ getatomprop(Client *c, Atom prop)
 	return atom;
 }
 
-int
-getrootptr(int *x, int *y)
+long long
+getms(void)
 {
-	int di;
-	unsigned int dui;
-	Window dummy;
+        struct timespec ts;
 
-	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
+/* The pointer position the event being handled carries, else a query. */
 int
-getwinptr(Window w, int *x, int *y)
+getrootptr(int *x, int *y)
 {
 	int di;
 	unsigned int dui;
 	Window dummy;
 
-	return XQueryPointer(dpy, w, &dummy, &dummy, &di, &di, x, y, &dui);
-}
-
-long
-getstate(Window w)
-{
-	int format;
-	long result = -1;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	Atom real;
-
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
-                        &real, &format, &n, &extra, (unsigned char **)&p) != Success) {
-		return -1;
+        if (ptrvalid) {
+                *x = ptrx;
+                *y = ptry;
+                return 1;
         }
-	if (n != 0)
-		result = *p;
-	XFree(p);
-	return result;
+	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
 int
 gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
-	char **list = NULL;
-	int n;
+        int ret;
 	XTextProperty name;
 
 	if (!text || size == 0)
@@ -1594,19 +2321,9 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 	text[0] = '\0';
 	if (!XGetTextProperty(dpy, w, &name, atom))
 		return 0;
-        if (!name.nitems) {
-                XFree(name.value);
-                return 0;
-        }
-	if (name.encoding == XA_STRING) {
-		strncpy(text, (char *)name.value, size - 1);
-	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
-		strncpy(text, *list, size - 1);
-		XFreeStringList(list);
-	}
-	text[size - 1] = '\0';
+        ret = decodetextprop(&name, text, size);
 	XFree(name.value);
-	return 1;
+	return ret;
 }
 
 long
@@ -1627,84 +2344,367 @@ getxembedflags(Window w)
         return flags;
 }
 
+/* Switches c between the button grabs of focused and unfocused clients, doing
+ * nothing if they are in place already. Unfocused clients only need the
+ * catch-all grab, which takes precedence over all others; buttonpress keeps their
+ * bound clicks from the client. */
 void
 grabbuttons(Client *c, int focused)
 {
-	updatenumlockmask();
-	{
-		unsigned int i, j;
-		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
+        int i;
 
-		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
-		if (!focused)
-			XGrabButton(dpy, AnyButton, AnyModifier, c->win, False,
-				BUTTONMASK, GrabModeSync, GrabModeSync, None, None);
-		for (i = 0; i < LENGTH(buttons); i++)
-			if (buttons[i].click == ClkClientWin || buttons[i].click == ClkLast)
-				for (j = 0; j < LENGTH(modifiers); j++)
-					XGrabButton(dpy, buttons[i].button,
-						buttons[i].mask | modifiers[j],
-						c->win, False, BUTTONMASK,
-						GrabModeAsync, GrabModeSync, None, None);
-	}
+        if (c->grabs == (focused ? GrabsFocused : GrabsUnfocused))
+                return;
+        if (focused) {
+                if (c->grabs != GrabsNone)
+                        XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
+                for (i = 0; i < nbuttongrabs; i++)
+                        XGrabButton(dpy, buttongrabs[i].button, buttongrabs[i].mod,
+                                    c->win, False, BUTTONMASK,
+                                    GrabModeAsync, GrabModeSync, None, None);
+        } else
+                XGrabButton(dpy, AnyButton, AnyModifier, c->win, False,
+                            BUTTONMASK, GrabModeSync, GrabModeSync, None, None);
+        c->grabs = focused ? GrabsFocused : GrabsUnfocused;
 }
 
+/* Grabs the keys of keys[] on the keycodes of updatekeymap, sending only the
+ * difference to the grabs in place. The active keyboard grab of fhints mode
+ * shadows these, so they stay put meanwhile. */
 void
 grabkeys(void)
 {
-        if (fhintsstate != FhintsOff) {
-		XUngrabKey(dpy, AnyKey, AnyModifier, root);
-		XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-		return;
-        } else
-                XUngrabKeyboard(dpy, CurrentTime);
+        unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
+        int i, j, k, m, n = 0;
+        KeyGrab *grabs;
+
+        for (k = 0; k < LENGTH(keysyms); k++)
+                for (i = keysyms[k] ? keyhash[KEYHASH(keysyms[k])] : 0; i; i = keynext[i - 1])
+                        if (keys[i - 1].keysym == keysyms[k])
+                                n += LENGTH(modifiers);
+        grabs = ecalloc(n ? n : 1, sizeof(KeyGrab));
+        n = 0;
+        for (k = 0; k < LENGTH(keysyms); k++)
+                for (i = keysyms[k] ? keyhash[KEYHASH(keysyms[k])] : 0; i; i = keynext[i - 1])
+                        if (keys[i - 1].keysym == keysyms[k])
+                                for (j = 0; j < LENGTH(modifiers); j++) {
+                                        grabs[n].code = k;
+                                        grabs[n++].mod = keys[i - 1].mod | modifiers[j];
+                                }
+        qsort(grabs, n, sizeof(KeyGrab), cmpkeygrabs);
+        for (i = j = 0; j < n; j++) /* drop duplicates */
+                if (!i || cmpkeygrabs(&grabs[i - 1], &grabs[j]))
+                        grabs[i++] = grabs[j];
+        n = i;
+        /* both lists are sorted, merge them */
+        for (i = j = 0; i < nkeygrabs || j < n;) {
+                m = i == nkeygrabs ? 1 : j == n ? -1 : cmpkeygrabs(&keygrabs[i], &grabs[j]);
+                if (m < 0) {
+                        XUngrabKey(dpy, keygrabs[i].code, keygrabs[i].mod, root);
+                        i++;
+                } else if (m > 0) {
+                        XGrabKey(dpy, grabs[j].code, grabs[j].mod, root, True,
+                                 GrabModeAsync, GrabModeAsync);
+                        j++;
+                } else
+                        i++, j++;
+        }
+        free(keygrabs);
+        keygrabs = grabs;
+        nkeygrabs = n;
+}
 
-	updatenumlockmask();
-	{
-		unsigned int i, j, k;
-		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
-		int start, end, skip;
-		KeySym *syms;
-
-		XUngrabKey(dpy, AnyKey, AnyModifier, root);
-		XDisplayKeycodes(dpy, &start, &end);
-		syms = XGetKeyboardMapping(dpy, start, end - start + 1, &skip);
-		if (!syms)
-			return;
-		for (k = start; k <= end; k++)
-			for (i = 0; i < LENGTH(keys); i++)
-				/* skip modifier codes, we do that ourselves */
-				if (keys[i].keysym == syms[(k - start) * skip])
-					for (j = 0; j < LENGTH(modifiers); j++)
-						XGrabKey(dpy, k,
-							 keys[i].mod | modifiers[j],
-							 root, True,
-							 GrabModeAsync, GrabModeAsync);
-		XFree(syms);
-	}
+/* Errors caused by requests sent between ignorebegin() and ignoreend() are
+ * ignored, which replaces the XSync and dummy error handler dance around
+ * requests that may hit already destroyed windows. Ranges whose requests the
+ * server has processed are dropped lazily. */
+void
+ignorebegin(void)
+{
+        unsigned long last = LastKnownRequestProcessed(dpy);
+        unsigned int tail;
+
+        while (ignorecount) {
+                tail = (ignorehead + IGNORERANGES - ignorecount) % IGNORERANGES;
+                if (ignores[tail].end >= last)
+                        break;
+                ignorecount--;
+        }
+        if (ignorecount == IGNORERANGES) /* overwrite the oldest */
+                ignorecount--;
+        ignores[ignorehead].start = NextRequest(dpy);
+        ignores[ignorehead].end = ~0UL; /* open until ignoreend */
+        ignorehead = (ignorehead + 1) % IGNORERANGES;
+        ignorecount++;
 }
 
 void
-incnmaster(const Arg *arg)
+ignoreend(void)
 {
-	selmon->nmaster = selmon->pertag->nmasters[selmon->pertag->curtag] =
-                MAX(selmon->nmaster + arg->i, 0);
-	arrange(selmon);
+        ignores[(ignorehead + IGNORERANGES - 1) % IGNORERANGES].end = NextRequest(dpy) - 1;
+}
+
+/* Tells whether c takes part in proto, see protomask, querying WM_PROTOCOLS
+ * only after it changed since manage. */
+int
+hasprotocol(Client *c, int proto)
+{
+        int n;
+        Atom *protocols;
+
+        if (!c->protovalid) {
+                c->protocols = 0;
+                if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
+                        while (n--)
+                                c->protocols |= protomask(protocols[n]);
+                        XFree(protocols);
+                }
+                c->protovalid = 1;
+        }
+        return c->protocols & proto;
 }
 
+/* Chains keys[] by keysym, keeping their order within each bucket. */
 void
-initsystray(void)
+hashkeys(void)
 {
-        XSetWindowAttributes wa = {
-                .override_redirect = True,
-                .background_pixel = scheme[SCHEMESYSTRAY][ColBg].pixel,
-                .event_mask = SubstructureRedirectMask|SubstructureNotifyMask
-        };
+        int i, h;
 
-        systray = ecalloc(1, sizeof(Systray));
-        systray->win = XCreateWindow(dpy, root, 0, -bh, 1, bh, 0, DefaultDepth(dpy, screen),
-                                     CopyFromParent, DefaultVisual(dpy, screen),
-                                     CWOverrideRedirect|CWBackPixel|CWEventMask, &wa);
+        for (i = LENGTH(keys) - 1; i >= 0; i--) {
+                h = KEYHASH(keys[i].keysym);
+                keynext[i] = keyhash[h];
+                keyhash[h] = i + 1;
+        }
+}
+
+/* Takes over the clients described by the blob of hotsave in fd, those whose
+ * window is still around, without asking for any of their properties. Returns
+ * 0 if the blob doesn't fit, the session file is restored then. */
+int
+hotrestore(int fd)
+{
+        struct stat st;
+        char *blob;
+        HotHead *h;
+        HotMon *hm;
+        HotClient *hc;
+        Window *hs;
+        Client *c, **tc, **ts;
+        Monitor *m;
+        xcb_get_window_attributes_cookie_t *ck;
+        xcb_get_window_attributes_reply_t *r;
+        char *alive;
+        unsigned int i, j, k;
+
+        if (fstat(fd, &st) < 0 || st.st_size < sizeof(HotHead)
+        || (blob = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+                close(fd);
+                fputs("dwm: cannot read the state of the restart\n", stderr);
+                return 0;
+        }
+        close(fd);
+        h = (HotHead *)blob;
+        if (h->magic != HOTMAGIC || h->version != HOTVERSION
+        || h->monsize != sizeof(HotMon) || h->clientsize != sizeof(HotClient)
+        || h->ntags != LENGTH(tags) || h->nlayouts != LENGTH(layouts) || h->nattachs != LENGTH(attachs)
+        || st.st_size != sizeof(HotHead) + h->nmons * sizeof(HotMon)
+                         + h->nclients * (sizeof(HotClient) + sizeof(Window))) {
+                munmap(blob, st.st_size);
+                fputs("dwm: state of the restart doesn't fit, restoring the session file\n", stderr);
+                return 0;
+        }
+        hm = (HotMon *)(h + 1);
+        hc = (HotClient *)(hm + h->nmons);
+        hs = (Window *)(hc + h->nclients);
+        for (i = k = 0; i < h->nmons; i++)
+                k += hm[i].nclients;
+        if (k != h->nclients) {
+                munmap(blob, st.st_size);
+                fputs("dwm: state of the restart doesn't fit, restoring the session file\n", stderr);
+                return 0;
+        }
+
+        /* leave out windows destroyed or withdrawn meanwhile, one round trip for
+         * all; dwm hides clients off-screen, they are never unmapped */
+        ck = ecalloc(h->nclients ? h->nclients : 1, sizeof *ck);
+        alive = ecalloc(h->nclients ? h->nclients : 1, 1);
+        for (i = 0; i < h->nclients; i++)
+                ck[i] = xcb_get_window_attributes(xcon, hc[i].win);
+        roundtrips++;
+        for (i = 0; i < h->nclients; i++) {
+                r = xcb_get_window_attributes_reply(xcon, ck[i], NULL);
+                alive[i] = r && !r->override_redirect && r->map_state != XCB_MAP_STATE_UNMAPPED;
+                free(r);
+        }
+        free(ck);
+
+        ignorebegin();
+        for (i = k = 0; i < h->nmons; k += hm[i].nclients, i++) {
+                for (m = mons; m && m->num != hm[i].num; m = m->next);
+                if (m) {
+                        m->showbar = hm[i].showbar;
+                        m->seltags = hm[i].seltags;
+                        m->sellt = hm[i].sellt;
+                        m->tagset[0] = hm[i].tagset[0];
+                        m->tagset[1] = hm[i].tagset[1];
+                        *m->pertag = hm[i].pertag;
+                        m->nmaster = m->pertag->nmasters[m->pertag->curtag];
+                        m->mfact = m->pertag->mfacts[m->pertag->curtag];
+                        m->lt[0] = &layouts[m->pertag->ltidxs[m->pertag->curtag][0]];
+                        m->lt[1] = &layouts[m->pertag->ltidxs[m->pertag->curtag][1]];
+                        strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol - 1);
+                        updatebarpos(m);
+                } else
+                        m = mons; /* monitor gone, its clients are kept */
+                for (tc = &m->clients; *tc; tc = &(*tc)->next);
+                for (ts = &m->stack; *ts; ts = &(*ts)->snext);
+                for (j = k; j < k + hm[i].nclients; j++) {
+                        HotClient *d = &hc[j];
+
+                        if (!alive[j])
+                                continue;
+                        c = ecalloc(1, sizeof(Client));
+                        c->win = d->win;
+                        memcpy(c->name, d->name, sizeof c->name);
+                        c->x = d->x, c->y = d->y, c->w = d->w, c->h = d->h;
+                        c->sfx = d->sfx, c->sfy = d->sfy, c->sfw = d->sfw, c->sfh = d->sfh;
+                        c->oldx = d->oldx, c->oldy = d->oldy, c->oldw = d->oldw, c->oldh = d->oldh;
+                        c->bw = d->bw, c->oldbw = d->oldbw, c->origbw = d->origbw;
+                        c->tags = d->tags;
+                        c->isfixed = d->isfixed, c->isfloating = d->isfloating;
+                        c->isurgent = d->isurgent, c->neverfocus = d->neverfocus;
+                        c->oldstate = d->oldstate, c->isfullscreen = d->isfullscreen;
+                        c->hintsvalid = d->hintsvalid, c->ishidden = d->ishidden;
+                        c->protocols = d->protocols, c->protovalid = d->protovalid;
+                        c->hashints = d->hashints, c->hints = d->hints;
+                        c->scratchkey = d->scratchkey;
+                        c->desktop = d->desktop, c->desktopsent = d->desktopsent;
+                        c->sh = d->sh;
+                        c->titlevalid = 0; /* may be stale, refetched when drawn */
+                        c->wmstate = NormalState;
+                        c->mon = m;
+                        *tc = c;
+                        tc = &c->next;
+                        winadd(c->win, WinClient, c);
+                        XSelectInput(dpy, c->win, EnterWindowMask|FocusChangeMask
+                                     |PropertyChangeMask|StructureNotifyMask);
+                        XSetWindowBorder(dpy, c->win, scheme[SchemeNorm][ColBorder].pixel);
+                        grabbuttons(c, 0);
+                }
+                /* the stack lists only windows of clients restored above */
+                for (j = k; j < k + hm[i].nclients; j++)
+                        if ((c = wintoclient(hs[j])) && c->mon == m) {
+                                *ts = c;
+                                ts = &c->snext;
+                        }
+                if (m->num == hm[i].num && (c = wintoclient(hm[i].sel)) && c->mon == m)
+                        m->sel = c;
+        }
+        ignoreend();
+        for (m = mons; m && m->num != h->selmon; m = m->next);
+        if (m)
+                selmon = m;
+        munmap(blob, st.st_size);
+        free(alive);
+        desktopsdirty = stackingdirty = 1;
+        updateclientlist();
+        arrange(NULL);
+        focus(NULL);
+        return 1;
+}
+
+/* Writes what a restarted dwm needs to take over the clients as they are, see
+ * hotrestore, into a memfd the exec inherits. Returns the fd, -1 on failure. */
+int
+hotsave(void)
+{
+        HotHead h = { HOTMAGIC, HOTVERSION, sizeof(HotMon), sizeof(HotClient),
+                      LENGTH(tags), LENGTH(layouts), LENGTH(attachs), 0, 0, selmon->num };
+        HotMon *hm;
+        HotClient *hc;
+        Window *hs;
+        Client *c;
+        Monitor *m;
+        char *blob;
+        size_t size, off;
+        ssize_t n;
+        int fd;
+
+        for (m = mons; m; m = m->next, h.nmons++)
+                for (c = m->clients; c; c = c->next)
+                        h.nclients++;
+        size = sizeof h + h.nmons * sizeof *hm + h.nclients * (sizeof *hc + sizeof *hs);
+        blob = ecalloc(1, size);
+        memcpy(blob, &h, sizeof h);
+        hm = (HotMon *)(blob + sizeof h);
+        hc = (HotClient *)(hm + h.nmons);
+        hs = (Window *)(hc + h.nclients);
+        for (m = mons; m; m = m->next, hm++) {
+                hm->num = m->num;
+                hm->showbar = m->showbar;
+                hm->seltags = m->seltags;
+                hm->sellt = m->sellt;
+                hm->tagset[0] = m->tagset[0];
+                hm->tagset[1] = m->tagset[1];
+                hm->sel = m->sel ? m->sel->win : None;
+                hm->pertag = *m->pertag;
+                for (c = m->clients; c; c = c->next, hc++, hm->nclients++) {
+                        hc->win = c->win;
+                        memcpy(hc->name, c->name, sizeof hc->name);
+                        hc->x = c->x, hc->y = c->y, hc->w = c->w, hc->h = c->h;
+                        hc->sfx = c->sfx, hc->sfy = c->sfy, hc->sfw = c->sfw, hc->sfh = c->sfh;
+                        hc->oldx = c->oldx, hc->oldy = c->oldy, hc->oldw = c->oldw, hc->oldh = c->oldh;
+                        hc->bw = c->bw, hc->oldbw = c->oldbw, hc->origbw = c->origbw;
+                        hc->tags = c->tags;
+                        hc->isfixed = c->isfixed, hc->isfloating = c->isfloating;
+                        hc->isurgent = c->isurgent, hc->neverfocus = c->neverfocus;
+                        hc->oldstate = c->oldstate, hc->isfullscreen = c->isfullscreen;
+                        hc->hintsvalid = c->hintsvalid, hc->ishidden = c->ishidden;
+                        hc->protocols = c->protocols, hc->protovalid = c->protovalid;
+                        hc->hashints = c->hashints, hc->hints = c->hints;
+                        hc->scratchkey = c->scratchkey;
+                        hc->desktop = c->desktop, hc->desktopsent = c->desktopsent;
+                        hc->sh = c->sh;
+                }
+                for (c = m->stack; c; c = c->snext)
+                        *hs++ = c->win;
+        }
+        if ((fd = syscall(SYS_memfd_create, "dwm-restart", 0)) < 0) {
+                free(blob);
+                return -1;
+        }
+        for (off = 0; off < size; off += n)
+                if ((n = write(fd, blob + off, size - off)) <= 0) {
+                        fputs("dwm: cannot write the state for the restart\n", stderr);
+                        close(fd);
+                        free(blob);
+                        return -1;
+                }
+        free(blob);
+        return fd;
+}
+
+void
+incnmaster(const Arg *arg)
+{
+	selmon->nmaster = selmon->pertag->nmasters[selmon->pertag->curtag] =
+                MAX(selmon->nmaster + arg->i, 0);
+	arrange(selmon);
+}
+
+void
+initsystray(void)
+{
+        XSetWindowAttributes wa = {
+                .override_redirect = True,
+                .background_pixel = scheme[SCHEMESYSTRAY][ColBg].pixel,
+                .event_mask = SubstructureRedirectMask|SubstructureNotifyMask
+        };
+
+        systray = ecalloc(1, sizeof(Systray));
+        systray->win = XCreateWindow(dpy, root, 0, -bh, 1, bh, 0, DefaultDepth(dpy, screen),
+                                     CopyFromParent, DefaultVisual(dpy, screen),
+                                     CWOverrideRedirect|CWBackPixel|CWEventMask, &wa);
         XChangeProperty(dpy, systray->win, netatom[NetSystemTrayOrientation], XA_CARDINAL, 32,
                         PropModeReplace, (unsigned char *)&netatom[NetSystemTrayOrientationHorz], 1);
         XSetSelectionOwner(dpy, netatom[NetSystemTray], systray->win, CurrentTime);
@@ -1735,17 +2735,412 @@ isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
 }
 #endif /* XINERAMA */
 
+/* Buffers r for the next journalpost */
+void
+journalappend(const JournalRecord *r)
+{
+        if (!journaling)
+                return;
+        if (njournal == journalcap) {
+                journalcap = journalcap ? journalcap * 2 : JOURNALBUF;
+                if (!(journalbuf = realloc(journalbuf, journalcap * sizeof *journalbuf)))
+                        die("dwm: realloc:");
+        }
+        memcpy(&journalbuf[njournal++], r, sizeof *r);
+}
+
+/* Buffers the state journaled differently, all of it if all. The records are
+ * zeroed before being filled in, their padding is compared too. */
+void
+journaldiff(int all)
+{
+        JournalRecord r;
+        Monitor *m;
+        Client *c;
+        Pertag *p;
+        unsigned int i;
+
+        for (m = mons; m; m = m->next) {
+                p = m->pertag;
+                memset(&r, 0, sizeof r);
+                r.kind = JournalMon;
+                r.num = m->num;
+                r.u.m.showbar = m->showbar;
+                r.u.m.selected = m == selmon;
+                r.u.m.tagset[0] = m->tagset[m->seltags];
+                r.u.m.tagset[1] = m->tagset[m->seltags ^ 1];
+                r.u.m.curtag = p->curtag;
+                r.u.m.prevtag = p->prevtag;
+                if (all || memcmp(&r.u.m, &m->journaled, sizeof r.u.m)) {
+                        memcpy(&m->journaled, &r.u.m, sizeof r.u.m);
+                        journalappend(&r);
+                }
+                for (i = 0; i <= LENGTH(tags); i++) {
+                        memset(&r, 0, sizeof r);
+                        r.kind = JournalTag;
+                        r.num = m->num;
+                        r.tag = i;
+                        r.u.t.nmaster = p->nmasters[i];
+                        r.u.t.mfact = p->mfacts[i];
+                        r.u.t.showtabs = p->showtabs[i];
+                        r.u.t.lt[0] = p->ltidxs[i][p->sellts[i]];
+                        r.u.t.lt[1] = p->ltidxs[i][p->sellts[i] ^ 1];
+                        r.u.t.att[0] = p->attidxs[i][p->selatts[i]];
+                        r.u.t.att[1] = p->attidxs[i][p->selatts[i] ^ 1];
+                        r.u.t.splus[0] = p->splus[i][0];
+                        r.u.t.splus[1] = p->splus[i][1];
+                        if (all || memcmp(&r.u.t, &p->journaled[i], sizeof r.u.t)) {
+                                memcpy(&p->journaled[i], &r.u.t, sizeof r.u.t);
+                                journalappend(&r);
+                        }
+                }
+                for (c = m->clients; c; c = c->next) {
+                        memset(&r, 0, sizeof r);
+                        r.kind = JournalClient;
+                        r.u.c.win = c->win;
+                        r.u.c.mon = m->num;
+                        r.u.c.tags = c->tags;
+                        r.u.c.isfloating = c->isfloating;
+                        r.u.c.ishidden = c->ishidden;
+                        r.u.c.scratchkey = c->scratchkey;
+                        if (all || memcmp(&r.u.c, &c->journaled, sizeof r.u.c)) {
+                                memcpy(&c->journaled, &r.u.c, sizeof r.u.c);
+                                journalappend(&r);
+                        }
+                }
+        }
+}
+
+/* Hands the buffered records over to the journal worker, after the head of a
+ * new journal if snapshot. The event loop never waits on the disk. */
+void
+journalpost(const JournalHead *snapshot)
+{
+        size_t n = njournal;
+
+        pthread_mutex_lock(&journalq.lock);
+        if (journalq.failed) {
+                pthread_mutex_unlock(&journalq.lock);
+                fputs("dwm: failed to write journal, journaling stopped\n", stderr);
+                journalstop(0);
+                return;
+        }
+        if (snapshot) {
+                journalq.n = 0; /* the snapshot has them */
+                journalq.head = *snapshot;
+                journalq.snapshot = 1;
+        }
+        if (journalq.n + n > journalq.cap) {
+                journalq.cap = MAX(journalq.n + n, journalq.cap * 2);
+                if (!(journalq.recs = realloc(journalq.recs, journalq.cap * sizeof *journalq.recs)))
+                        die("dwm: realloc:");
+        }
+        memcpy(journalq.recs + journalq.n, journalbuf, n * sizeof *journalbuf);
+        journalq.n += n;
+        pthread_cond_signal(&journalq.cond);
+        pthread_mutex_unlock(&journalq.lock);
+        njournal = 0;
+        journalsize += n * sizeof *journalbuf;
+}
+
+/* Writes all of data to fd, returns 0 on failure */
+int
+journalput(int fd, const void *data, size_t size)
+{
+        size_t off;
+        ssize_t n;
+
+        for (off = 0; off < size; off += n)
+                if ((n = write(fd, (const char *)data + off, size - off)) <= 0)
+                        return 0;
+        return 1;
+}
+
+/* Restores what a dwm that didn't exit cleanly left in the journal, as
+ * restoresession does. The journal stays until journalsnapshot replaces it. */
+void
+journalreplay(void)
+{
+        JournalHead h;
+        JournalRecord r, *cs;
+        Monitor *m, *sel = NULL;
+        Pertag *p;
+        Client *c;
+        struct stat st;
+        size_t i, n = 0;
+        FILE *fp;
+        unsigned int token[2];
+
+        if (!*journalpath || !(fp = fopen(journalpath, "r")))
+                return;
+        if (fstat(fileno(fp), &st) < 0 || fread(&h, sizeof h, 1, fp) != 1
+        || h.magic != JOURNALMAGIC || h.version != JOURNALVERSION
+        || h.recsize != sizeof r || h.ntags != LENGTH(tags)) {
+                fputs("dwm: journal doesn't fit, ignored\n", stderr);
+                fclose(fp);
+                return;
+        }
+        /* left by a dwm of this X server, not of one before */
+        if (!journaltoken(token) || token[0] != h.token[0] || token[1] != h.token[1]) {
+                fclose(fp);
+                return;
+        }
+        cs = ecalloc(MAX((st.st_size - sizeof h) / sizeof r, 1), sizeof r);
+        /* a record torn by the crash is left out */
+        while (fread(&r, sizeof r, 1, fp) == 1) {
+                switch (r.kind) {
+                case JournalMon:
+                        for (m = mons; m && m->num != r.num; m = m->next);
+                        if (!m || r.u.m.showbar < 0 || r.u.m.showbar > 1
+                        || r.u.m.tagset[0] != (r.u.m.tagset[0] & TAGMASK)
+                        || r.u.m.tagset[1] != (r.u.m.tagset[1] & TAGMASK)
+                        || r.u.m.curtag > LENGTH(tags) || r.u.m.prevtag > LENGTH(tags)
+                        || !((r.u.m.curtag == 0 && r.u.m.tagset[0] == TAGMASK)
+                             || (r.u.m.curtag && (1 << (r.u.m.curtag - 1)) & r.u.m.tagset[0])))
+                                break;
+                        m->showbar = r.u.m.showbar;
+                        m->tagset[m->seltags] = r.u.m.tagset[0];
+                        m->tagset[m->seltags ^ 1] = r.u.m.tagset[1];
+                        m->pertag->curtag = r.u.m.curtag;
+                        m->pertag->prevtag = r.u.m.prevtag;
+                        if (r.u.m.selected)
+                                sel = m;
+                        break;
+                case JournalTag:
+                        for (m = mons; m && m->num != r.num; m = m->next);
+                        if (!m || r.tag > LENGTH(tags) || r.u.t.nmaster < 0
+                        || r.u.t.mfact < MINMFACT || r.u.t.mfact > MAXMFACT
+                        || r.u.t.showtabs < 0 || r.u.t.showtabs > 1
+                        || r.u.t.lt[0] >= LENGTH(layouts) || r.u.t.lt[1] >= LENGTH(layouts)
+                        || r.u.t.att[0] >= LENGTH(attachs) || r.u.t.att[1] >= LENGTH(attachs))
+                                break;
+                        p = m->pertag;
+                        i = r.tag;
+                        p->nmasters[i] = r.u.t.nmaster;
+                        p->mfacts[i] = r.u.t.mfact;
+                        p->showtabs[i] = r.u.t.showtabs;
+                        p->ltidxs[i][p->sellts[i]] = r.u.t.lt[0];
+                        p->ltidxs[i][p->sellts[i] ^ 1] = r.u.t.lt[1];
+                        p->attidxs[i][p->selatts[i]] = r.u.t.att[0];
+                        p->attidxs[i][p->selatts[i] ^ 1] = r.u.t.att[1];
+                        p->splus[i][0] = r.u.t.splus[0];
+                        p->splus[i][1] = r.u.t.splus[1];
+                        break;
+                case JournalClient:
+                case JournalGone:
+                        r.num = n; /* order among the records of a window */
+                        cs[n++] = r;
+                        break;
+                }
+        }
+        fclose(fp);
+
+        /* only the last record of each window counts */
+        qsort(cs, n, sizeof *cs, cmpclientrecords);
+        for (i = 0; i < n; i++) {
+                if ((i + 1 < n && cs[i + 1].u.c.win == cs[i].u.c.win)
+                || cs[i].kind == JournalGone || !(c = wintoclient(cs[i].u.c.win)))
+                        continue;
+                if (cs[i].u.c.tags != (cs[i].u.c.tags & TAGMASK)
+                || cs[i].u.c.isfloating < 0 || cs[i].u.c.isfloating > 1
+                || cs[i].u.c.ishidden < 0 || cs[i].u.c.ishidden > 1)
+                        continue;
+                c->tags = cs[i].u.c.tags;
+                c->isfloating = cs[i].u.c.isfloating;
+                c->ishidden = cs[i].u.c.ishidden;
+                if (!c->scratchkey)
+                        c->scratchkey = cs[i].u.c.scratchkey;
+                for (m = mons; m && m->num != cs[i].u.c.mon; m = m->next);
+                if (m && m != c->mon) {
+                        detach(c);
+                        detachstack(c);
+                        c->mon = m;
+                        attachs[PTATT(m)].attach(c);
+                        attachstack(c);
+                }
+                updateclientdesktop(c, 0);
+        }
+        free(cs);
+
+        for (m = mons; m; m = m->next) {
+                p = m->pertag;
+                m->nmaster = p->nmasters[p->curtag];
+                m->mfact = p->mfacts[p->curtag];
+                m->lt[0] = &layouts[p->ltidxs[p->curtag][0]];
+                m->lt[1] = &layouts[p->ltidxs[p->curtag][1]];
+                strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol - 1);
+        }
+        if (sel)
+                selmon = sel;
+        arrange(NULL);
+        focus(NULL);
+}
+
+/* Replaces the journal by a snapshot of the state, and journals on top of it
+ * from then on. Starts the journal worker the first time. */
+void
+journalsnapshot(void)
+{
+        JournalHead h = { .magic = JOURNALMAGIC, .version = JOURNALVERSION,
+                          .recsize = sizeof(JournalRecord), .ntags = LENGTH(tags) };
+
+        if (!*journalpath)
+                return;
+        if (!journaling) {
+                if (!journaltoken(journalid)) {
+                        struct timespec ts;
+                        long token[2];
+
+                        clock_gettime(CLOCK_REALTIME, &ts);
+                        journalid[0] = (unsigned int)(ts.tv_nsec ^ getpid() << 16) | 1;
+                        journalid[1] = ts.tv_sec;
+                        token[0] = journalid[0], token[1] = journalid[1];
+                        XChangeProperty(dpy, root, dwmatom[DWMJournal], XA_CARDINAL, 32,
+                                        PropModeReplace, (unsigned char *)token, 2);
+                }
+                if ((errno = pthread_create(&journalthread, NULL, journalwork, NULL))) {
+                        perror("dwm: cannot start journal worker");
+                        return;
+                }
+                journaling = 1;
+        }
+        h.token[0] = journalid[0];
+        h.token[1] = journalid[1];
+        njournal = 0;
+        journalsize = sizeof h;
+        journaldiff(1);
+        journalpost(&h);
+}
+
+/* Stops journaling, after the worker wrote what it was handed. A dwm exiting
+ * cleanly deletes the journal, otherwise the last one written stays for a dwm
+ * started after a crash. */
+void
+journalstop(int clean)
+{
+        if (!journaling)
+                return;
+        pthread_mutex_lock(&journalq.lock);
+        journalq.quit = 1;
+        pthread_cond_signal(&journalq.cond);
+        pthread_mutex_unlock(&journalq.lock);
+        pthread_join(journalthread, NULL);
+        journaling = 0;
+        njournal = 0;
+        journalq.n = 0;
+        journalq.snapshot = journalq.quit = journalq.failed = 0;
+        if (clean && unlink(journalpath) < 0 && errno != ENOENT)
+                fputs("dwm: failed to delete journal\n", stderr);
+}
+
+/* Journals what changed since the last call. Scheduled by flush, so that the
+ * event path pays a timer at most, and the records go to the worker at once. */
+void
+journalsync(void)
+{
+        if (!journaling)
+                return;
+        if (journalsize >= JOURNALMAX) {
+                journalsnapshot();
+                return;
+        }
+        journaldiff(0);
+        if (njournal)
+                journalpost(NULL);
+}
+
+/* The token the root window has for the journals of this X server, 0 if none */
+int
+journaltoken(unsigned int token[2])
+{
+        Atom type;
+        int format, ok;
+        unsigned long nitems, after;
+        unsigned char *p = NULL;
+
+        ok = XGetWindowProperty(dpy, root, dwmatom[DWMJournal], 0L, 2L, False, XA_CARDINAL,
+                                &type, &format, &nitems, &after, &p) == Success
+             && p && type == XA_CARDINAL && format == 32 && nitems == 2;
+        if (ok) {
+                token[0] = ((unsigned long *)p)[0];
+                token[1] = ((unsigned long *)p)[1];
+        }
+        if (p)
+                XFree(p);
+        return ok;
+}
+
+/* The journal worker: writes and syncs what journalpost handed over, a
+ * snapshot into a new file renamed over the journal so that a crash leaves
+ * either of them. A failure leaves the journal as it was and ends the worker,
+ * the next journalpost stops journaling. */
+void *
+journalwork(void *arg)
+{
+        JournalRecord *recs = NULL;
+        JournalHead head;
+        size_t n, cap = 0;
+        int fd, snapshot, quit, ok = 1;
+
+        do {
+                pthread_mutex_lock(&journalq.lock);
+                while (!journalq.n && !journalq.snapshot && !journalq.quit)
+                        pthread_cond_wait(&journalq.cond, &journalq.lock);
+                /* take the records, leaving the buffer written last for the next ones */
+                SWAP(recs, journalq.recs);
+                SWAP(cap, journalq.cap);
+                n = journalq.n;
+                head = journalq.head;
+                snapshot = journalq.snapshot;
+                quit = journalq.quit;
+                journalq.n = journalq.snapshot = 0;
+                pthread_mutex_unlock(&journalq.lock);
+
+                if (snapshot) {
+                        if ((fd = open(journalnew, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600)) < 0) {
+                                ok = 0;
+                        } else if (!(ok = journalput(fd, &head, sizeof head)
+                                          && journalput(fd, recs, n * sizeof *recs)
+                                          && fdatasync(fd) == 0
+                                          && rename(journalnew, journalpath) == 0)) {
+                                close(fd);
+                                unlink(journalnew);
+                        } else {
+                                if (journalfd >= 0)
+                                        close(journalfd);
+                                journalfd = fd;
+                        }
+                } else if (n)
+                        ok = journalfd >= 0 && journalput(journalfd, recs, n * sizeof *recs)
+                             && fdatasync(journalfd) == 0;
+        } while (ok && !quit);
+
+        if (!ok) {
+                pthread_mutex_lock(&journalq.lock);
+                journalq.failed = 1;
+                pthread_mutex_unlock(&journalq.lock);
+        }
+        if (journalfd >= 0)
+                close(journalfd);
+        journalfd = -1;
+        /* the other buffer stays with journalq */
+        free(recs);
+        return NULL;
+}
+
 void
 keypress(XEvent *e)
 {
+        TRACE_FUNC();
         int fhs;
 	unsigned int i;
         Client *c = NULL;
+        const Key *k;
 	KeySym keysym;
 	XKeyEvent *ev;
 
 	ev = &e->xkey;
-	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
+	keysym = keysyms[ev->keycode & 0xff];
         if (fhintsstate != FhintsOff) {
                 for (i = 0; i < LENGTH(fhints); i++)
                         if (keysym == fhints[i].keysym)
@@ -1754,7 +3149,7 @@ keypress(XEvent *e)
                 fhs = fhintsstate;
                 fhintsstate = FhintsOff;
                 destroyfhints();
-                grabkeys();
+                XUngrabKeyboard(dpy, CurrentTime);
                 drawtabs();
                 if (!c)
                         return;
@@ -1764,11 +3159,12 @@ keypress(XEvent *e)
                         pop(c);
                 }
         } else {
-                for (i = 0; i < LENGTH(keys); i++) {
-                        if (keysym == keys[i].keysym
-                        && CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-                        && keys[i].func) {
-                                keys[i].func(&(keys[i].arg));
+                for (i = keyhash[KEYHASH(keysym)]; i; i = keynext[i - 1]) {
+                        k = &keys[i - 1];
+                        if (keysym == k->keysym
+                        && CLEANMASK(k->mod) == CLEANMASK(ev->state)
+                        && k->func) {
+                                k->func(&(k->arg));
                         }
                 }
         }
@@ -1779,41 +3175,61 @@ killclient(const Arg *arg)
 {
 	if (!selmon->sel)
 		return;
-	if (!sendevent(selmon->sel->win, wmatom[WMDelete], NoEventMask,
-                       wmatom[WMDelete], CurrentTime, 0, 0, 0)) {
+        if (hasprotocol(selmon->sel, ProtoDelete))
+                sendevent(selmon->sel->win, wmatom[WMDelete], NoEventMask,
+                          wmatom[WMDelete], CurrentTime, 0, 0, 0);
+        else {
 		XGrabServer(dpy);
-		XSetErrorHandler(xerrordummy);
+		ignorebegin();
 		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
+		ignoreend();
 		XUngrabServer(dpy);
 	}
 }
 
 void
 manage(Window w, XWindowAttributes *wa)
+{
+        TRACE_FUNC();
+        Props p;
+
+        opbegin(OpManage);
+        /* one round trip for all properties */
+        requestprops(w, &p);
+        receiveprops(&p);
+        roundtrips++;
+        managehelper(w, wa, &p);
+	focus(NULL);
+        opend();
+}
+
+/* manage without updating focus, so that many windows can be adopted at once */
+Client *
+managehelper(Window w, XWindowAttributes *wa, Props *p)
 {
 	Client *c, *t = NULL;
-	Window trans = None;
 	XWindowChanges wc;
 
 	c = ecalloc(1, sizeof(Client));
 	c->win = w;
+        c->desktopsent = c->wmstate = -1;
 	/* geometry */
 	c->x = c->oldx = wa->x;
 	c->y = c->oldy = wa->y;
 	c->w = c->oldw = wa->width;
 	c->h = c->oldh = wa->height;
-	c->oldbw = wa->border_width;
+	c->oldbw = c->origbw = wa->border_width;
         c->bw = borderpx;
 
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+        memcpy(c->name, p->name, sizeof c->name);
+        applytitle(c);
+	if (p->hastrans && (t = wintoclient(p->trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
 	} else {
 		c->mon = selmon;
-		applyrules(c);
+		applyrules(c, p->class[0] ? p->class : broken,
+                           p->instance[0] ? p->instance : broken, p->role);
 	}
 
 	if (c->x + WIDTH(c) > c->mon->wx + c->mon->ww)
@@ -1827,9 +3243,14 @@ manage(Window w, XWindowAttributes *wa)
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatewindowtype(c, 1);
-        updategeomhints(c);
-	updatewmhints(c);
+        applywindowtype(c, p->state, p->wtype, 1);
+        setgeomhints(c, &p->size);
+        if ((c->hashints = p->hashints)) {
+                c->hints = p->hints;
+                setwmhints(c, &c->hints);
+        }
+        c->protocols = p->protocols;
+        c->protovalid = 1;
 	c->sfx = c->x;
 	c->sfy = c->y;
 	c->sfw = c->w;
@@ -1837,11 +3258,12 @@ manage(Window w, XWindowAttributes *wa)
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0);
 	if (!c->isfloating)
-		c->isfloating = c->oldstate = trans != None || c->isfixed;
+		c->isfloating = c->oldstate = p->trans != None || c->isfixed;
 	if (c->isfloating)
 		XRaiseWindow(dpy, c->win);
         attachs[PTATT(c->mon)].attach(c);
 	attachstack(c);
+        winadd(c->win, WinClient, c);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
@@ -1851,8 +3273,8 @@ manage(Window w, XWindowAttributes *wa)
 	c->mon->sel = c;
 	arrange(c->mon);
 	XMapWindow(dpy, c->win);
-	focus(NULL);
 	updateclientdesktop(c, 0);
+        return c;
 }
 
 void
@@ -1861,15 +3283,21 @@ mappingnotify(XEvent *e)
 	XMappingEvent *ev = &e->xmapping;
 
 	XRefreshKeyboardMapping(ev);
-	if (ev->request == MappingKeyboard)
-		grabkeys();
+        if (ev->request == MappingPointer)
+                return;
+        if (ev->request == MappingKeyboard && !xkbevent) /* else see xkbnotify */
+                updatekeymap();
+        updategrabs();
 }
 
 void
 maprequest(XEvent *e)
 {
+        TRACE_FUNC();
 	static XWindowAttributes wa;
         Icon *i;
+        Entry *r;
+        Toplevel *t;
 	XMapRequestEvent *ev = &e->xmaprequest;
 
         if ((i = wintosystrayicon(ev->window))) {
@@ -1880,15 +3308,49 @@ maprequest(XEvent *e)
                 XMapWindow(dpy, i->win);
                 return;
         }
-	if (!XGetWindowAttributes(dpy, ev->window, &wa))
+        if ((r = winentry(ev->window)) && r->kind == WinClient)
+                return;
+        if (r && r->kind == WinToplevel) {
+                t = r->p;
+                wa.x = t->x;
+                wa.y = t->y;
+                wa.width = t->w;
+                wa.height = t->h;
+                wa.border_width = t->bw;
+                free(t);
+                windel(ev->window);
+        } else if (!XGetWindowAttributes(dpy, ev->window, &wa))
 		return;
-	if (!wintoclient(ev->window))
-		manage(ev->window, &wa);
+	manage(ev->window, &wa);
+}
+
+/* XMaskEvent for the grab loops, which the main loop doesn't see; the recorded
+ * grab events in a replay */
+void
+maskevent(long mask, XEvent *ev)
+{
+        int k;
+
+        if (replayfp) {
+                /* let a grab go where its recording ended */
+                if ((k = replayread(ev)) != RecGrabbed) {
+                        replayback = k;
+                        replayev = *ev;
+                        memset(ev, 0, sizeof *ev);
+                        ev->type = ButtonRelease;
+                }
+                return;
+        }
+        XMaskEvent(dpy, mask, ev);
+        if (recording)
+                rec_event(ev, 1);
+        trackpointer(ev);
 }
 
 void
 monocle(Monitor *m)
 {
+        TRACE_FUNC();
 	Client *c;
 
         /* override layout symbol */
@@ -1933,12 +3395,13 @@ void
 motionnotify(XEvent *e)
 {
         int x;
+        Entry *r;
         Monitor *m;
         XMotionEvent *ev = &e->xmotion;
 
-        for (m = mons; m && m->barwin != ev->window; m = m->next);
-        if (!m)
+        if (!(r = winentry(ev->window)) || r->kind != WinBar)
                 return;
+        m = r->p;
         if (m == selmon && ISSTATUSDRAWN()
                         && (x = selmon->ww - stw - lrpad / 2 - ev->x) > 0
                         && (x -= wstext - lrpad) <= 0) {
@@ -1963,6 +3426,7 @@ movemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
         restack(selmon);
+        flush();
 	ocx = c->x;
 	ocy = c->y;
 	if (!getrootptr(&x, &y))
@@ -1972,7 +3436,7 @@ movemouse(const Arg *arg)
 		return;
         }
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		maskevent(MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
 		switch (ev.type) {
 		case ConfigureRequest:
 		case Expose:
@@ -2003,6 +3467,7 @@ movemouse(const Arg *arg)
 				resize(c, nx, ny, c->w, c->h, 1);
 			break;
 		}
+                flush();
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
@@ -2018,6 +3483,34 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* Accounts time, round trips and requests until the matching opend to op,
+ * inclusive of the operations nested in between. */
+void
+opbegin(int op)
+{
+        if (opdepth < OPDEPTH) {
+                opstack[opdepth].op = op;
+                opstack[opdepth].t0 = stats_now();
+                opstack[opdepth].rt = roundtrips;
+                opstack[opdepth].req = NextRequest(dpy);
+        }
+        opdepth++;
+}
+
+void
+opend(void)
+{
+        int op;
+
+        if (--opdepth >= OPDEPTH)
+                return;
+        op = opstack[opdepth].op;
+        stats_add(&opstats[op], stats_now() - opstack[opdepth].t0);
+        opreqs[op].calls++;
+        opreqs[op].roundtrips += roundtrips - opstack[opdepth].rt;
+        opreqs[op].requests += NextRequest(dpy) - opstack[opdepth].req;
+}
+
 void
 pop(Client *c)
 {
@@ -2030,6 +3523,7 @@ pop(Client *c)
 void
 propertynotify(XEvent *e)
 {
+        TRACE_FUNC();
 	Client *c;
         Icon *i;
 	Window trans;
@@ -2037,6 +3531,8 @@ propertynotify(XEvent *e)
 
 	if ((ev->window == root) && (ev->atom == XA_WM_NAME))
 		updatestatus();
+        else if (ev->atom == wmatom[WMProtocols] && (c = wintoclient(ev->window)))
+                c->protovalid = 0; /* deleted ones too */
 	else if (ev->state == PropertyDelete)
 		return; /* ignore */
 	else if ((c = wintoclient(ev->window))) {
@@ -2058,10 +3554,10 @@ propertynotify(XEvent *e)
 			return;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
-			updatetitle(c);
-			if (c == c->mon->sel)
-				drawbar(c->mon);
-			drawtab(c->mon);
+                        /* hidden titles are only refetched once shown */
+                        c->titlevalid = 0;
+                        if (ISVISIBLE(c))
+                                queuetitle(c);
 		} else if (ev->atom == netatom[NetWMWindowType]) {
 			updatewindowtype(c, 0);
                 }
@@ -2076,12 +3572,218 @@ propertynotify(XEvent *e)
         }
 }
 
+void
+publishdesktops(void)
+{
+        for (Monitor *m = mons; m; m = m->next)
+                for (Client *c = m->clients; c; c = c->next)
+                        if (c->desktop != c->desktopsent) {
+                                c->desktopsent = c->desktop;
+                                XChangeProperty(dpy, c->win, netatom[NetWMDesktop], XA_CARDINAL,
+                                                32, PropModeReplace, (unsigned char *)&c->desktop, 1);
+                        }
+}
+
+/* Proto* bit of a WM_PROTOCOLS atom, 0 for those dwm doesn't use */
+int
+protomask(Atom a)
+{
+        return a == wmatom[WMTakeFocus] ? ProtoTakeFocus :
+               a == wmatom[WMDelete] ? ProtoDelete : 0;
+}
+
+/* Defers answering a configure request of c to the next frame, at most
+ * refreshrate frames per second, so that request storms cost one answer. */
+void
+queueconfig(Client *c, int what)
+{
+        long long now;
+
+        c->cfgpending |= what;
+        if (cfgdue)
+                return;
+        now = getms();
+        cfgdue = MAX(now, cfglast + 1000 / refreshrate);
+        schedule(cfgdue - now, applyconfigs);
+}
+
+/* Redraws the changed title of c in this frame, unless it changed in the
+ * last one too; titles changing faster are redrawn once per frame. */
+void
+queuetitle(Client *c)
+{
+        long long now = getms();
+
+        if (now - c->titlelast >= 1000 / refreshrate) {
+                c->titlelast = now;
+                if (c == c->mon->sel)
+                        drawbar(c->mon);
+                drawtab(c->mon);
+        } else if (!titledue) {
+                titledue = c->titlelast + 1000 / refreshrate;
+                schedule(titledue - now, applytitles);
+        }
+}
+
 void
 quit(const Arg *arg)
 {
         runningstate = arg->i ? Restart : Stop;
 }
 
+void
+readsignals(int fd)
+{
+        struct signalfd_siginfo si;
+
+        while (read(fd, &si, sizeof si) == sizeof si)
+                switch (si.ssi_signo) {
+                case SIGCHLD:
+                        while (waitpid(-1, NULL, WNOHANG) > 0);
+                        break;
+                case SIGHUP:
+                        runningstate = Restart;
+                        break;
+                case SIGTERM:
+                        runningstate = Stop;
+                        break;
+                case SIGUSR1:
+                        dumpstats(NULL);
+                        break;
+                case SIGUSR2:
+                        toggletrace(NULL);
+                        break;
+                }
+}
+
+void
+readtimers(int fd)
+{
+        int i, n = 0;
+        long long now = getms();
+        uint64_t expirations;
+        void (*due[MAXTIMERS])(void);
+
+        if (read(fd, &expirations, sizeof expirations) == -1 && errno != EAGAIN)
+                return;
+        /* take the due ones out first, they may schedule themselves again */
+        for (i = 0; i < ntimers;)
+                if (timers[i].due <= now) {
+                        due[n++] = timers[i].func;
+                        timers[i] = timers[--ntimers];
+                } else
+                        i++;
+        updatetimer();
+        for (i = 0; i < n; i++)
+                due[i]();
+}
+
+/* Collects the replies to requestprops. Only this waits on the server, once
+ * for all of them. */
+void
+receiveprops(Props *p)
+{
+        int i, n;
+        uint32_t *v;
+        char *str;
+        xcb_get_property_reply_t *r[PropLast];
+        xcb_generic_error_t *e;
+
+        for (i = 0; i < PropLast; i++) {
+                e = NULL;
+                r[i] = xcb_get_property_reply(xcon, p->ck[i], &e);
+                free(e);
+        }
+        if (!replytext(r[PropNetWMName], p->name, sizeof p->name))
+                replytext(r[PropWMName], p->name, sizeof p->name);
+        replytext(r[PropRole], p->role, sizeof p->role);
+        /* WM_CLASS is "instance\0class\0" */
+        p->class[0] = p->instance[0] = '\0';
+        if (r[PropClass] && r[PropClass]->type == XA_STRING && r[PropClass]->format == 8 &&
+            (n = xcb_get_property_value_length(r[PropClass]))) {
+                str = xcb_get_property_value(r[PropClass]);
+                i = strnlen(str, n);
+                snprintf(p->instance, sizeof p->instance, "%.*s", i, str);
+                if (i + 1 < n)
+                        snprintf(p->class, sizeof p->class, "%.*s",
+                                 (int)strnlen(str + i + 1, n - i - 1), str + i + 1);
+        }
+        p->hastrans = r[PropTransient] && r[PropTransient]->type == XA_WINDOW &&
+                      r[PropTransient]->format == 32 && r[PropTransient]->value_len > 0;
+        p->trans = p->hastrans ? *(uint32_t *)xcb_get_property_value(r[PropTransient]) : None;
+        p->state = r[PropState] && r[PropState]->type == XA_ATOM && r[PropState]->value_len > 0
+                   ? *(uint32_t *)xcb_get_property_value(r[PropState]) : None;
+        p->wtype = r[PropType] && r[PropType]->type == XA_ATOM && r[PropType]->value_len > 0
+                   ? *(uint32_t *)xcb_get_property_value(r[PropType]) : None;
+        /* the wire formats of WM_SIZE_HINTS and WM_HINTS (ICCCM 4.1.2.3, 4.1.2.4) */
+        memset(&p->size, 0, sizeof p->size);
+        if ((p->hassize = r[PropNormalHints] && r[PropNormalHints]->type == XA_WM_SIZE_HINTS &&
+                          r[PropNormalHints]->format == 32 && r[PropNormalHints]->value_len >= 15)) {
+                v = xcb_get_property_value(r[PropNormalHints]);
+                p->size.flags = v[0];
+                p->size.x = (int32_t)v[1];
+                p->size.y = (int32_t)v[2];
+                p->size.width = (int32_t)v[3];
+                p->size.height = (int32_t)v[4];
+                p->size.min_width = (int32_t)v[5];
+                p->size.min_height = (int32_t)v[6];
+                p->size.max_width = (int32_t)v[7];
+                p->size.max_height = (int32_t)v[8];
+                p->size.width_inc = (int32_t)v[9];
+                p->size.height_inc = (int32_t)v[10];
+                p->size.min_aspect.x = (int32_t)v[11];
+                p->size.min_aspect.y = (int32_t)v[12];
+                p->size.max_aspect.x = (int32_t)v[13];
+                p->size.max_aspect.y = (int32_t)v[14];
+                if (r[PropNormalHints]->value_len >= 18) {
+                        p->size.base_width = (int32_t)v[15];
+                        p->size.base_height = (int32_t)v[16];
+                        p->size.win_gravity = (int32_t)v[17];
+                } else
+                        p->size.flags &= ~(PBaseSize|PWinGravity);
+        } else
+                p->size.flags = PSize; /* as after a failed XGetWMNormalHints */
+        memset(&p->hints, 0, sizeof p->hints);
+        if ((p->hashints = r[PropHints] && r[PropHints]->type == XA_WM_HINTS &&
+                           r[PropHints]->format == 32 && r[PropHints]->value_len >= 8)) {
+                v = xcb_get_property_value(r[PropHints]);
+                p->hints.flags = v[0];
+                p->hints.input = (int32_t)v[1];
+                p->hints.initial_state = (int32_t)v[2];
+                p->hints.icon_pixmap = v[3];
+                p->hints.icon_window = v[4];
+                p->hints.icon_x = (int32_t)v[5];
+                p->hints.icon_y = (int32_t)v[6];
+                p->hints.icon_mask = v[7];
+                if (r[PropHints]->value_len >= 9)
+                        p->hints.window_group = v[8];
+                else
+                        p->hints.flags &= ~WindowGroupHint;
+        }
+        p->protocols = 0;
+        if (r[PropProtocols] && r[PropProtocols]->type == XA_ATOM && r[PropProtocols]->format == 32) {
+                v = xcb_get_property_value(r[PropProtocols]);
+                for (n = r[PropProtocols]->value_len; n--;)
+                        p->protocols |= protomask(v[n]);
+        }
+        for (i = 0; i < PropLast; i++)
+                free(r[i]);
+}
+
+/* Writes the events the main loop sees, and what they make dwm read from the
+ * server, to a trace at path for replay. */
+void
+record(const char *path)
+{
+        if (!(recording = rec_start(dpy, path)))
+                return;
+        rec_alias(root, RecRoot, 0);
+        for (Monitor *m = mons; m; m = m->next) {
+                rec_alias(m->barwin, RecBar, m->num);
+                rec_alias(m->tabwin, RecTab, m->num);
+        }
+}
+
 Monitor *
 recttomon(int x, int y, int w, int h)
 {
@@ -2096,6 +3798,20 @@ recttomon(int x, int y, int w, int h)
 	return r;
 }
 
+/* slot of a recorded id in a replay table, free if from is not in there */
+Remap *
+remap(Remap *t, unsigned int from)
+{
+        unsigned int i = from * 2654435761u & (REMAPSIZE - 1), n = 0;
+
+        while (t[i].from && t[i].from != from) {
+                if (++n == REMAPSIZE)
+                        die("dwm: replay: too many windows or atoms in trace");
+                i = (i + 1) & (REMAPSIZE - 1);
+        }
+        return &t[i];
+}
+
 void
 removesystrayicon(Icon *i)
 {
@@ -2103,6 +3819,7 @@ removesystrayicon(Icon *i)
 
         for (ti = &systray->icons; *ti && *ti != i; ti = &(*ti)->next);
         *ti = i->next;
+        windel(i->win);
         if (i->ismapped)
                 updatesystray();
         free(i);
@@ -2112,10 +3829,297 @@ void
 reparentnotify(XEvent *e)
 {
         Icon *i;
+        Entry *r;
 	XReparentEvent *ev = &e->xreparent;
 
         if ((i = wintosystrayicon(ev->window)) && ev->parent != systray->win)
                 removesystrayicon(i);
+        /* no longer a toplevel, toplevels reparented to the root are queried */
+        else if ((r = winentry(ev->window)) && r->kind == WinToplevel && ev->parent != root) {
+                free(r->p);
+                windel(ev->window);
+        }
+}
+
+/* Feeds a trace written by record through the handlers, in the batches the main
+ * loop drained, against stand-in windows on this display. Prints the handler
+ * time of every event and the flush time of every batch, then the totals. */
+void
+replay(const char *path)
+{
+	int i, k, n;
+        unsigned int gen = 0;
+        unsigned long seq = 0;
+        unsigned long long t;
+	static XEvent evs[EVENTBATCH];
+
+        if (!(replayfp = rec_open(path)))
+                die("dwm: cannot open trace '%s'", path);
+        printf("%8s %-20s %10s\n", "seq", "event", "time(us)");
+        do {
+                if (++gen == 0)
+                        gen = 1;
+                for (n = 0; n < EVENTBATCH && (k = replayread(&evs[n])) != RecBatch && k != -1; n++)
+                        coalesce(evs, n, gen);
+                for (i = 0; i < n && runningstate == Running; i++) {
+                        if (!evs[i].type || evs[i].type >= LASTEvent)
+                                continue;
+                        trackpointer(&evs[i]);
+                        t = stats_now();
+                        if (handler[evs[i].type])
+                                handler[evs[i].type](&evs[i]);
+                        t = stats_now() - t;
+                        if (handler[evs[i].type])
+                                stats_add(&evstats[evs[i].type], t);
+                        if (evstats[evs[i].type].name)
+                                printf("%8lu %-20s %10.1f\n", ++seq, evstats[evs[i].type].name, t / 1e3);
+                        else
+                                printf("%8lu %-20d %10.1f\n", ++seq, evs[i].type, t / 1e3);
+                }
+                t = stats_now();
+                flush();
+                XSync(dpy, True); /* drop what the stand-ins made the server send */
+                printf("%8s %-20s %10.1f\n", "", "flush", (stats_now() - t) / 1e3);
+        } while (k != -1 && runningstate == Running);
+        fclose(replayfp);
+        replayfp = NULL;
+        putchar('\n');
+        writestats(stdout);
+}
+
+Atom
+replayatom(unsigned int a)
+{
+        Remap *r;
+
+        if (a <= XA_LAST_PREDEFINED)
+                return a;
+        r = remap(ratoms, a);
+        return r->from ? r->to : None;
+}
+
+/* moves a recorded event over to the stand-ins */
+void
+replayevent(XEvent *ev)
+{
+        Remap *r;
+
+        ev->xany.display = dpy;
+        ev->xany.window = replaywin(ev->xany.window);
+        switch (ev->type) {
+        case KeyPress:
+        case KeyRelease:
+                ev->xkey.root = replaywin(ev->xkey.root);
+                ev->xkey.subwindow = replaywin(ev->xkey.subwindow);
+                break;
+        case ButtonPress:
+        case ButtonRelease:
+                ev->xbutton.root = replaywin(ev->xbutton.root);
+                ev->xbutton.subwindow = replaywin(ev->xbutton.subwindow);
+                break;
+        case MotionNotify:
+                ev->xmotion.root = replaywin(ev->xmotion.root);
+                ev->xmotion.subwindow = replaywin(ev->xmotion.subwindow);
+                break;
+        case EnterNotify:
+        case LeaveNotify:
+                ev->xcrossing.root = replaywin(ev->xcrossing.root);
+                ev->xcrossing.subwindow = replaywin(ev->xcrossing.subwindow);
+                break;
+        case CreateNotify:
+                ev->xcreatewindow.window = replaywin(ev->xcreatewindow.window);
+                break;
+        case DestroyNotify:
+                /* the window is gone by the time its DestroyNotify is read */
+                r = remap(rwins, ev->xdestroywindow.window);
+                ev->xdestroywindow.window = r->from ? r->to : None;
+                if (r->from && r->to) {
+                        XDestroyWindow(dpy, r->to);
+                        r->to = None;
+                }
+                break;
+        case UnmapNotify:
+                ev->xunmap.window = replaywin(ev->xunmap.window);
+                break;
+        case MapNotify:
+                ev->xmap.window = replaywin(ev->xmap.window);
+                break;
+        case MapRequest:
+                ev->xmaprequest.window = replaywin(ev->xmaprequest.window);
+                break;
+        case ReparentNotify:
+                ev->xreparent.window = replaywin(ev->xreparent.window);
+                ev->xreparent.parent = replaywin(ev->xreparent.parent);
+                break;
+        case ConfigureNotify:
+                ev->xconfigure.window = replaywin(ev->xconfigure.window);
+                ev->xconfigure.above = replaywin(ev->xconfigure.above);
+                break;
+        case ConfigureRequest:
+                ev->xconfigurerequest.window = replaywin(ev->xconfigurerequest.window);
+                ev->xconfigurerequest.above = replaywin(ev->xconfigurerequest.above);
+                break;
+        case PropertyNotify:
+                ev->xproperty.atom = replayatom(ev->xproperty.atom);
+                break;
+        case ClientMessage:
+                ev->xclient.message_type = replayatom(ev->xclient.message_type);
+                if (ev->xclient.message_type == netatom[NetWMState]) {
+                        ev->xclient.data.l[1] = replayatom(ev->xclient.data.l[1]);
+                        ev->xclient.data.l[2] = replayatom(ev->xclient.data.l[2]);
+                }
+                break;
+        }
+}
+
+/* sets a recorded property on the stand-in it belongs to */
+void
+replayprop(RecPropData *d)
+{
+        Window w = replaywin(d->win);
+        Atom prop = replayatom(d->atom), type = replayatom(d->type);
+        unsigned int i, *v = (unsigned int *)(d + 1);
+        long *l;
+
+        if (!w || !prop)
+                return;
+        if (!d->format || !type) {
+                XDeleteProperty(dpy, w, prop);
+                return;
+        }
+        if (d->format != 32) {
+                XChangeProperty(dpy, w, prop, type, d->format, PropModeReplace,
+                                (unsigned char *)v, d->nitems);
+                return;
+        }
+        l = ecalloc(MAX(d->nitems, 1), sizeof *l);
+        for (i = 0; i < d->nitems; i++)
+                l[i] = type == XA_ATOM ? replayatom(v[i]) :
+                       type == XA_WINDOW ? replaywin(v[i]) : v[i];
+        XChangeProperty(dpy, w, prop, type, 32, PropModeReplace, (unsigned char *)l, d->nitems);
+        free(l);
+}
+
+/* Applies the records up to the next event, which it moves into ev. Returns
+ * the kind of that record, RecBatch at the end of a batch, -1 at the end. */
+int
+replayread(XEvent *ev)
+{
+        static unsigned int data[REC_MAXDATA / 4 + 1]; /* aligned for the records */
+        RecHead h;
+        Remap *r;
+        Monitor *m;
+        int k;
+
+        if ((k = replayback) != -1) {
+                replayback = -1;
+                *ev = replayev;
+                return k;
+        }
+        while (rec_read(replayfp, &h, data)) {
+                ((char *)data)[h.len] = '\0';
+                switch (h.kind) {
+                case RecEvent:
+                case RecGrabbed:
+                        memset(ev, 0, sizeof *ev);
+                        memcpy(ev, data, MIN((size_t)h.len, sizeof *ev));
+                        replayevent(ev);
+                        return h.kind;
+                case RecBatch:
+                        return RecBatch;
+                case RecAtom:
+                        r = remap(ratoms, ((RecAtomData *)data)->atom);
+                        r->from = ((RecAtomData *)data)->atom;
+                        r->to = XInternAtom(dpy, (char *)data + sizeof(RecAtomData), False);
+                        break;
+                case RecAlias: {
+                        RecAliasData *d = (RecAliasData *)data;
+
+                        for (m = mons; m && m->num != d->num; m = m->next);
+                        r = remap(rwins, d->win);
+                        r->from = d->win;
+                        r->to = d->what == RecRoot ? root : !m ? None :
+                                d->what == RecBar ? m->barwin : m->tabwin;
+                        break;
+                }
+                case RecWindow: {
+                        RecWindowData *d = (RecWindowData *)data;
+
+                        /* a stand-in for each window that asks to be mapped */
+                        r = remap(rwins, d->win);
+                        if (r->from && r->to)
+                                XMoveResizeWindow(dpy, r->to, d->x, d->y,
+                                                  MAX(d->w, 1), MAX(d->h, 1));
+                        else {
+                                r->from = d->win;
+                                r->to = XCreateSimpleWindow(dpy, root, d->x, d->y,
+                                                            MAX(d->w, 1), MAX(d->h, 1), d->bw, 0, 0);
+                        }
+                        break;
+                }
+                case RecProp:
+                        replayprop((RecPropData *)data);
+                        break;
+                }
+        }
+        return -1;
+}
+
+Window
+replaywin(unsigned int w)
+{
+        Remap *r;
+
+        if (!w)
+                return None;
+        r = remap(rwins, w);
+        return r->from ? r->to : None;
+}
+
+/* gettextprop for a property reply */
+int
+replytext(xcb_get_property_reply_t *r, char *text, unsigned int size)
+{
+        int n, ret;
+        XTextProperty name;
+
+        text[0] = '\0';
+        if (!r || !r->type || !(n = xcb_get_property_value_length(r)))
+                return 0;
+        name.encoding = r->type;
+        name.format = r->format;
+        name.nitems = r->value_len;
+        name.value = ecalloc(n + 1, 1); /* NUL terminated as by Xlib */
+        memcpy(name.value, xcb_get_property_value(r), n);
+        ret = decodetextprop(&name, text, size);
+        free(name.value);
+        return ret;
+}
+
+/* Sends, without waiting, everything manage needs to know about w. */
+void
+requestprops(Window w, Props *p)
+{
+        p->ck[PropNetWMName] = xcb_get_property(xcon, 0, w, netatom[NetWMName],
+                                                XCB_ATOM_ANY, 0, PROPLENGTH);
+        p->ck[PropWMName] = xcb_get_property(xcon, 0, w, XA_WM_NAME,
+                                             XCB_ATOM_ANY, 0, PROPLENGTH);
+        p->ck[PropTransient] = xcb_get_property(xcon, 0, w, XA_WM_TRANSIENT_FOR,
+                                                XA_WINDOW, 0, 1);
+        p->ck[PropClass] = xcb_get_property(xcon, 0, w, XA_WM_CLASS,
+                                            XA_STRING, 0, PROPLENGTH);
+        p->ck[PropRole] = xcb_get_property(xcon, 0, w, wmatom[WMWindowRole],
+                                           XCB_ATOM_ANY, 0, PROPLENGTH);
+        p->ck[PropState] = xcb_get_property(xcon, 0, w, netatom[NetWMState],
+                                            XA_ATOM, 0, 1);
+        p->ck[PropType] = xcb_get_property(xcon, 0, w, netatom[NetWMWindowType],
+                                           XA_ATOM, 0, 1);
+        p->ck[PropNormalHints] = xcb_get_property(xcon, 0, w, XA_WM_NORMAL_HINTS,
+                                                  XA_WM_SIZE_HINTS, 0, 18);
+        p->ck[PropHints] = xcb_get_property(xcon, 0, w, XA_WM_HINTS,
+                                            XA_WM_HINTS, 0, 9);
+        p->ck[PropProtocols] = xcb_get_property(xcon, 0, w, wmatom[WMProtocols],
+                                                XA_ATOM, 0, 32);
 }
 
 void
@@ -2126,9 +4130,23 @@ resetsplus(const Arg *arg)
                 selmon->lt[selmon->sellt]->arrange(selmon);
 }
 
+/* Clears the statistics dumpstats writes, to measure from here on. */
+void
+resetstats(const Arg *arg)
+{
+        for (int i = 0; i < LASTEvent; i++)
+                evstats[i] = (Hist){ .name = evstats[i].name };
+        for (int i = 0; i < OpLast; i++)
+                opstats[i] = (Hist){ .name = opstats[i].name };
+        memset(opreqs, 0, sizeof opreqs);
+        evcoalesced = 0;
+}
+
 void
 resize(Client *c, int x, int y, int w, int h, int interact)
 {
+        TRACE_FUNC();
+
 	if (applygeomhints(c, &x, &y, &w, &h, interact))
 		resizeclient(c, x, y, w, h);
 }
@@ -2136,6 +4154,7 @@ resize(Client *c, int x, int y, int w, int h, int interact)
 void
 resizeclient(Client *c, int x, int y, int w, int h)
 {
+        TRACE_FUNC();
 	XWindowChanges wc;
 
 	c->oldx = c->x; c->x = wc.x = x;
@@ -2145,7 +4164,7 @@ resizeclient(Client *c, int x, int y, int w, int h)
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 	configure(c);
-	XSync(dpy, False);
+        c->cfgpending = 0; /* answered */
 }
 
 void
@@ -2162,19 +4181,22 @@ resizemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
         restack(selmon);
+        flush();
 	ocx = c->x;
 	ocy = c->y;
         ocw = c->w;
         och = c->h;
-        if (!getwinptr(c->win, &px, &py))
+        if (!getrootptr(&px, &py))
 	        return;
+        px -= c->x + c->bw;
+        py -= c->y + c->bw;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
                         None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess) {
 		return;
         }
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		maskevent(MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
 		switch (ev.type) {
 		case ConfigureRequest:
 		case Expose:
@@ -2199,8 +4221,10 @@ resizemouse(const Arg *arg)
 				resize(c, c->x, c->y, nw, nh, 1);
 			break;
 		}
+                flush();
 	} while (ev.type != ButtonRelease);
         XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, (px * c->w) / ocw , (py * c->h) / och);
+        ptrvalid = 0;
 	XUngrabPointer(dpy, CurrentTime);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
@@ -2212,12 +4236,16 @@ resizemouse(const Arg *arg)
 void
 restack(Monitor *m)
 {
+        m->dirty |= DirtyStack|DirtyBar|DirtyTab;
+}
+
+void
+restackmon(Monitor *m)
+{
+        TRACE_FUNC();
 	Client *c;
-	XEvent ev;
 	XWindowChanges wc;
 
-	drawbar(m);
-	drawtab(m);
 	if (!m->sel)
 		return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
@@ -2231,8 +4259,6 @@ restack(Monitor *m)
 				wc.sibling = c->win;
 			}
 	}
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
 /* Checks for fake signal in root name and removes if there is one, restoring
@@ -2256,13 +4282,63 @@ restorestatus(void)
 void
 run(void)
 {
-	XEvent ev;
+	int i, j, n;
+        unsigned int gen = 0;
+	static XEvent evs[EVENTBATCH];
+        struct pollfd pfds[MAXWATCHES + 1];
 
 	/* main event loop */
 	XSync(dpy, False);
-	while (runningstate == Running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	while (runningstate == Running) {
+                flush();
+                /* sleep only once our requests are sent and nothing is queued */
+                if (!XEventsQueued(dpy, QueuedAfterFlush)) {
+                        pfds[0].fd = ConnectionNumber(dpy);
+                        pfds[0].events = POLLIN;
+                        for (n = 0; n < nwatches; n++) {
+                                pfds[n + 1].fd = watches[n].fd;
+                                pfds[n + 1].events = POLLIN;
+                        }
+                        if (poll(pfds, n + 1, -1) == -1) {
+                                if (errno == EINTR)
+                                        continue;
+                                die("dwm: poll:");
+                        }
+                        for (i = 1; i <= n; i++) {
+                                if (!pfds[i].revents)
+                                        continue;
+                                /* a watch may have removed others */
+                                for (j = 0; j < nwatches && watches[j].fd != pfds[i].fd; j++);
+                                if (j < nwatches)
+                                        watches[j].func(pfds[i].fd);
+                        }
+                        if (!XEventsQueued(dpy, QueuedAfterReading))
+                                continue;
+                }
+                /* drain everything pending into a batch, dropping superseded events;
+                 * a ButtonPress ends it, the grab loops of movemouse and
+                 * resizemouse wait in XMaskEvent for the events queued after it */
+                if (++gen == 0)
+                        gen = 1;
+                for (n = 0; n < EVENTBATCH && XPending(dpy);) {
+                        XNextEvent(dpy, &evs[n]);
+                        if (recording)
+                                rec_event(&evs[n], 0);
+                        coalesce(evs, n, gen);
+                        if (evs[n++].type == ButtonPress)
+                                break;
+                }
+                if (recording)
+                        rec_batch();
+                for (i = 0; i < n && runningstate == Running; i++) {
+                        trackpointer(&evs[i]);
+                        if (xkbevent && evs[i].type == xkbevent)
+                                xkbnotify(&evs[i]);
+                        else if (evs[i].type < LASTEvent && handler[evs[i].type]) /* call handler */
+                                STATS_TIME(&evstats[evs[i].type], handler[evs[i].type](&evs[i]));
+                }
+                ptrvalid = 0;
+        }
 }
 
 void
@@ -2429,7 +4505,7 @@ restoresession(void)
                 setfocus(selmon->sel);
         } else {
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		setactivewindow(None);
 	}
         if (fclose(fp) != 0)
                 fputs("dwm: restoresession: failed to close sessionfile\n", stderr);
@@ -2437,30 +4513,102 @@ restoresession(void)
                 fputs("dwm: restoresession: failed to delete sessionfile\n", stderr);
 }
 
+/* Adopts the existing toplevels. Requests for all of them are pipelined, so
+ * this takes a few round trips no matter how many windows there are, and
+ * focus is updated only once at the end. */
 void
 scan(void)
 {
-	unsigned int i, num;
+	unsigned int i, n = 0, num;
+        int pass;
 	Window d1, d2, *wins = NULL;
-	XWindowAttributes wa;
-
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
-				manage(wins[i], &wa);
-		}
+        struct {
+                xcb_get_window_attributes_cookie_t ack;
+                xcb_get_geometry_cookie_t gck;
+                xcb_get_property_cookie_t sck;
+                XWindowAttributes wa;
+                Props p;
+        } *s;
+        xcb_get_window_attributes_reply_t *ar;
+        xcb_get_geometry_reply_t *gr;
+        xcb_get_property_reply_t *sr;
+        xcb_generic_error_t *e[3];
+
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num))
+                return;
+        if (num == 0) {
                 XFree(wins);
-	}
+                return;
+        }
+        s = ecalloc(num, sizeof *s);
+        for (i = 0; i < num; i++) {
+                s[i].ack = xcb_get_window_attributes(xcon, wins[i]);
+                s[i].gck = xcb_get_geometry(xcon, wins[i]);
+                s[i].sck = xcb_get_property(xcon, 0, wins[i], wmatom[WMState],
+                                            wmatom[WMState], 0, 2);
+        }
+        /* keep the windows to adopt at the front, their replies are consumed */
+        roundtrips++;
+        for (i = 0; i < num; i++) {
+                e[0] = e[1] = e[2] = NULL;
+                ar = xcb_get_window_attributes_reply(xcon, s[i].ack, &e[0]);
+                gr = xcb_get_geometry_reply(xcon, s[i].gck, &e[1]);
+                sr = xcb_get_property_reply(xcon, s[i].sck, &e[2]);
+                if (ar && gr && !ar->override_redirect && !wintoclient(wins[i])
+                && (ar->map_state == IsViewable ||
+                    (sr && sr->type == wmatom[WMState] && sr->format == 32 && sr->value_len > 0
+                     && *(uint32_t *)xcb_get_property_value(sr) == IconicState))) {
+                        s[n].wa.x = gr->x;
+                        s[n].wa.y = gr->y;
+                        s[n].wa.width = gr->width;
+                        s[n].wa.height = gr->height;
+                        s[n].wa.border_width = gr->border_width;
+                        s[n].wa.map_state = ar->map_state;
+                        s[n].wa.override_redirect = False;
+                        requestprops(wins[i], &s[n].p);
+                        wins[n++] = wins[i];
+                }
+                free(ar), free(gr), free(sr);
+                free(e[0]), free(e[1]), free(e[2]);
+        }
+        for (i = 0; i < n; i++)
+                receiveprops(&s[i].p);
+        roundtrips += n > 0;
+        /* transients after the windows they belong to */
+        for (pass = 0; pass < 2; pass++)
+                for (i = 0; i < n; i++)
+                        if (!s[i].p.hastrans == !pass) {
+                                opbegin(OpManage);
+                                managehelper(wins[i], &s[i].wa, &s[i].p);
+                                opend();
+                        }
+        free(s);
+        XFree(wins);
+        if (n)
+                focus(NULL);
+}
+
+/* Calls func from the event loop in ms milliseconds. A func already pending
+ * keeps the earlier of the two deadlines. */
+void
+schedule(int ms, void (*func)(void))
+{
+        int i;
+        long long due = getms() + ms;
+
+        for (i = 0; i < ntimers && timers[i].func != func; i++);
+        if (i == ntimers) {
+                if (ntimers == MAXTIMERS) {
+                        fputs("dwm: too many timers\n", stderr);
+                        return;
+                }
+                timers[ntimers].func = func;
+                timers[ntimers++].due = due;
+        } else if (due < timers[i].due) {
+                timers[i].due = due;
+        } else
+                return;
+        updatetimer();
 }
 
 void
@@ -2471,8 +4619,7 @@ scratchhidehelper(void)
         selmon->sel->tags = 0;
         t = selmon->sel->scratchkey > DYNSCRATCHKEY(0) ?
                 3 * (1 + LENGTH(tags)) + selmon->sel->scratchkey - DYNSCRATCHKEY(0) : 0;
-        XChangeProperty(dpy, selmon->sel->win, netatom[NetWMDesktop], XA_CARDINAL,
-                        32, PropModeReplace, (unsigned char *) &t, 1);
+        setclientdesktop(selmon->sel, t);
         focus(NULL);
         arrange(selmon);
 }
@@ -2508,39 +4655,23 @@ scratchshowhelper(int key)
         return 0;
 }
 
-int
+/* WM_PROTOCOLS messages go only to clients taking part, see hasprotocol */
+void
 sendevent(Window w, Atom proto, int mask, long d0, long d1, long d2, long d3, long d4)
 {
-	int n;
-        int exists = 0;
-        Atom mt;
-	Atom *protocols;
 	XEvent ev;
 
-	if (proto == wmatom[WMTakeFocus] || proto == wmatom[WMDelete]) {
-		mt = wmatom[WMProtocols];
-		if (XGetWMProtocols(dpy, w, &protocols, &n)) {
-			while (!exists && n--)
-				exists = protocols[n] == proto;
-			XFree(protocols);
-		}
-	} else {
-                exists = 1;
-		mt = proto;
-	}
-	if (exists) {
-		ev.type = ClientMessage;
-		ev.xclient.window = w;
-		ev.xclient.message_type = mt;
-		ev.xclient.format = 32;
-		ev.xclient.data.l[0] = d0;
-		ev.xclient.data.l[1] = d1;
-		ev.xclient.data.l[2] = d2;
-		ev.xclient.data.l[3] = d3;
-		ev.xclient.data.l[4] = d4;
-		XSendEvent(dpy, w, False, mask, &ev);
-	}
-	return exists;
+	ev.type = ClientMessage;
+	ev.xclient.window = w;
+	ev.xclient.message_type = proto == wmatom[WMTakeFocus] || proto == wmatom[WMDelete]
+	                          ? wmatom[WMProtocols] : proto;
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = d0;
+	ev.xclient.data.l[1] = d1;
+	ev.xclient.data.l[2] = d2;
+	ev.xclient.data.l[3] = d3;
+	ev.xclient.data.l[4] = d4;
+	XSendEvent(dpy, w, False, mask, &ev);
 }
 
 void
@@ -2558,6 +4689,21 @@ sendmon(Client *c, Monitor *m)
 	arrange(NULL);
 }
 
+/* Publishes w as _NET_ACTIVE_WINDOW, deleting it for None, unless it is so
+ * already. */
+void
+setactivewindow(Window w)
+{
+        if (w == activewin)
+                return;
+        activewin = w;
+        if (w)
+                XChangeProperty(dpy, root, netatom[NetActiveWindow], XA_WINDOW, 32,
+                                PropModeReplace, (unsigned char *)&w, 1);
+        else
+                XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+}
+
 void
 setattach(const Arg *arg)
 {
@@ -2578,11 +4724,24 @@ setattorprev(const Arg *arg)
         }
 }
 
+/* The value is written by publishdesktops, once per frame and only if it
+ * changed, so that clients moving back and forth within a frame cost nothing. */
+void
+setclientdesktop(Client *c, long desktop)
+{
+        c->desktop = desktop;
+        if (desktop != c->desktopsent)
+                desktopsdirty = 1;
+}
+
 void
 setclientstate(Client *c, long state)
 {
 	long data[] = { state, None };
 
+        if (state == c->wmstate)
+                return;
+        c->wmstate = state;
 	XChangeProperty(dpy, c->win, wmatom[WMState], wmatom[WMState], 32,
                         PropModeReplace, (unsigned char *)data, 2);
 }
@@ -2606,11 +4765,11 @@ setfocus(Client *c)
 {
 	if (!c->neverfocus) {
 		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-		XChangeProperty(dpy, root, netatom[NetActiveWindow], XA_WINDOW, 32,
-			PropModeReplace, (unsigned char *) &(c->win), 1);
+		setactivewindow(c->win);
 	}
-	sendevent(c->win, wmatom[WMTakeFocus], NoEventMask, wmatom[WMTakeFocus],
-                  CurrentTime, 0, 0, 0);
+        if (hasprotocol(c, ProtoTakeFocus))
+                sendevent(c->win, wmatom[WMTakeFocus], NoEventMask, wmatom[WMTakeFocus],
+                          CurrentTime, 0, 0, 0);
 }
 
 void
@@ -2641,6 +4800,15 @@ setfullscreen(Client *c, int fullscreen)
 	}
 }
 
+void
+setgeomhints(Client *c, XSizeHints *size)
+{
+        setsizehints(&c->sh, size);
+	c->isfixed = (c->sh.maxw && c->sh.maxh && c->sh.maxw == c->sh.minw
+                                               && c->sh.maxh == c->sh.minh);
+        c->hintsvalid = 1;
+}
+
 void
 setlayout(const Arg *arg)
 {
@@ -2691,6 +4859,42 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+setsizehints(SizeHints *sh, XSizeHints *size)
+{
+	if (size->flags & PBaseSize) {
+		sh->basew = size->base_width;
+		sh->baseh = size->base_height;
+	} else if (size->flags & PMinSize) {
+		sh->basew = size->min_width;
+		sh->baseh = size->min_height;
+	} else
+		sh->basew = sh->baseh = 0;
+	if (size->flags & PResizeInc) {
+		sh->incw = size->width_inc;
+		sh->inch = size->height_inc;
+	} else
+		sh->incw = sh->inch = 0;
+	if (size->flags & PMaxSize) {
+		sh->maxw = size->max_width;
+		sh->maxh = size->max_height;
+	} else
+		sh->maxw = sh->maxh = 0;
+	if (size->flags & PMinSize) {
+		sh->minw = size->min_width;
+		sh->minh = size->min_height;
+	} else if (size->flags & PBaseSize) {
+		sh->minw = size->base_width;
+		sh->minh = size->base_height;
+	} else
+		sh->minw = sh->minh = 0;
+	if (size->flags & PAspect) {
+		sh->mina = (float)size->min_aspect.y / size->min_aspect.x;
+		sh->maxa = (float)size->max_aspect.x / size->max_aspect.y;
+	} else
+		sh->maxa = sh->mina = 0.0;
+}
+
 void
 setsplus(const Arg *arg)
 {
@@ -2720,17 +4924,34 @@ setsplus(const Arg *arg)
 void
 setup(void)
 {
-	int i;
+	int i, major, minor;
 	XSetWindowAttributes wa;
 	Atom utf8string;
 	struct sigaction sa;
+        sigset_t sigmask;
+        char *dir, *q;
 
-	/* do not transform children into zombies when they terminate */
+	/* children are reaped by the event loop on SIGCHLD */
 	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
-	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = SA_NOCLDSTOP | SA_RESTART;
+	sa.sa_handler = SIG_DFL;
 	sigaction(SIGCHLD, &sa, NULL);
 
+        /* handle signals synchronously from the event loop */
+        sigemptyset(&sigmask);
+        sigaddset(&sigmask, SIGCHLD);
+        sigaddset(&sigmask, SIGHUP);
+        sigaddset(&sigmask, SIGTERM);
+        sigaddset(&sigmask, SIGUSR1);
+        sigaddset(&sigmask, SIGUSR2);
+        sigprocmask(SIG_BLOCK, &sigmask, NULL);
+        if ((sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+                die("dwm: signalfd:");
+        if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) == -1)
+                die("dwm: timerfd_create:");
+        addwatch(sigfd, readsignals);
+        addwatch(timerfd, readtimers);
+
 	/* clean up any zombies (inherited from .xinitrc etc) immediately */
 	while (waitpid(-1, NULL, WNOHANG) > 0);
 
@@ -2738,7 +4959,25 @@ setup(void)
         if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
 		fputs("warning: could not set dwm as subreaper\n", stderr);
 
+	/* init window registry */
+	wintablebits = WINTABLEBITS;
+	wintable = ecalloc(1 << wintablebits, sizeof(Entry *));
+
+        /* one session journal per display, see journalsnapshot */
+        if (!(dir = getenv("XDG_RUNTIME_DIR")) || !*dir)
+                fputs("dwm: XDG_RUNTIME_DIR not set, no session journal\n", stderr);
+        else if (snprintf(journalpath, sizeof journalpath, "%s/" JOURNALFILE "%s",
+                          dir, DisplayString(dpy)) >= sizeof journalpath)
+                *journalpath = '\0';
+        else {
+                for (q = journalpath + strlen(dir) + 1; *q; q++)
+                        if (*q == '/')
+                                *q = '_';
+                snprintf(journalnew, sizeof journalnew, "%s.new", journalpath);
+        }
+
 	/* init screen */
+        xcon = XGetXCBConnection(dpy);
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
@@ -2757,6 +4996,7 @@ setup(void)
 	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
 	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
         wmatom[WMWindowRole] = XInternAtom(dpy, "WM_WINDOW_ROLE", False);
+        dwmatom[DWMJournal] = XInternAtom(dpy, "_DWM_JOURNAL", False);
 	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
 	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	netatom[NetSystemTray] = XInternAtom(dpy, "_NET_SYSTEM_TRAY_S0", False);
@@ -2772,6 +5012,7 @@ setup(void)
 	netatom[NetDesktopNames] = XInternAtom(dpy, "_NET_DESKTOP_NAMES", False);
 	netatom[NetWMDesktop] = XInternAtom(dpy, "_NET_WM_DESKTOP", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetClientListStacking] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
 	xatom[Manager] = XInternAtom(dpy, "MANAGER", False);
 	xatom[Xembed] = XInternAtom(dpy, "_XEMBED", False);
 	xatom[XembedInfo] = XInternAtom(dpy, "_XEMBED_INFO", False);
@@ -2803,6 +5044,8 @@ setup(void)
 		PropModeReplace, (unsigned char *) netatom, NetLast);
 	setdesktopnames();
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
+	XDeleteProperty(dpy, root, netatom[NetActiveWindow]); /* see activewin */
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor;
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
@@ -2810,6 +5053,16 @@ setup(void)
 		|LeaveWindowMask|StructureNotifyMask|PropertyChangeMask;
 	XChangeWindowAttributes(dpy, root, CWEventMask|CWCursor, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
+        hashkeys();
+        major = XkbMajorVersion, minor = XkbMinorVersion;
+        if (XkbQueryExtension(dpy, NULL, &xkbevent, NULL, &major, &minor))
+                XkbSelectEvents(dpy, XkbUseCoreKbd, XkbNewKeyboardNotifyMask|XkbMapNotifyMask,
+                                XkbNewKeyboardNotifyMask|XkbMapNotifyMask);
+        else
+                xkbevent = 0;
+        updatekeymap();
+        updatenumlockmask();
+        updatebuttongrabs();
 	grabkeys();
 	focus(NULL);
 }
@@ -2817,14 +5070,29 @@ setup(void)
 void
 seturgent(Client *c, int urg)
 {
-	XWMHints *wmh;
-
 	c->isurgent = urg;
-	if (!(wmh = XGetWMHints(dpy, c->win)))
-		return;
-	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
-	XSetWMHints(dpy, c->win, wmh);
-	XFree(wmh);
+        /* write the cached hints back only if the bit really flips */
+        if (!c->hashints || !(c->hints.flags & XUrgencyHint) == !urg)
+                return;
+        c->hints.flags ^= XUrgencyHint;
+	XSetWMHints(dpy, c->win, &c->hints);
+}
+
+void
+setwmhints(Client *c, XWMHints *wmh)
+{
+        if (c == selmon->sel && wmh->flags & XUrgencyHint) {
+                wmh->flags &= ~XUrgencyHint;
+                XSetWMHints(dpy, c->win, wmh);
+        } else {
+                c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
+                if (c->isurgent)
+                        XSetWindowBorder(dpy, c->win, scheme[SchemeUrg][ColBorder].pixel);
+        }
+        if (wmh->flags & InputHint)
+                c->neverfocus = !wmh->input;
+        else
+                c->neverfocus = 0;
 }
 
 void
@@ -2871,6 +5139,8 @@ shiftview(const Arg *arg)
 void
 showhide(Client *c)
 {
+        TRACE_FUNC();
+
 	if (!c)
 		return;
 	if (ISVISIBLE(c)) {
@@ -2931,12 +5201,38 @@ spawn(const Arg *arg)
 		sa.sa_flags = 0;
 		sa.sa_handler = SIG_DFL;
 		sigaction(SIGCHLD, &sa, NULL);
+                sigprocmask(SIG_SETMASK, &sa.sa_mask, NULL); /* blocked for signalfd */
 
 		execvp(((char **)arg->v)[0], (char **)arg->v);
 		die("dwm: execvp '%s' failed:", ((char **)arg->v)[0]);
 	}
 }
 
+/* The focus history of all clients, bottom to top: the monitors other than
+ * selmon, then selmon, each from its least recently focused client. Window
+ * switchers list from the top. The caller frees the list. */
+Window *
+stacklineup(int *n)
+{
+        Client *c;
+        Monitor *m;
+        Window *wins;
+        int i = 0;
+
+        for (m = mons; m; m = m->next)
+                for (c = m->stack; c; c = c->snext)
+                        i++;
+        wins = ecalloc(i ? i : 1, sizeof(Window));
+        *n = i;
+        for (c = selmon->stack; c; c = c->snext)
+                wins[--i] = c->win;
+        for (m = mons; m; m = m->next)
+                if (m != selmon)
+                        for (c = m->stack; c; c = c->snext)
+                                wins[--i] = c->win;
+        return wins;
+}
+
 void
 swaptags(const Arg *arg)
 {
@@ -3007,8 +5303,7 @@ tagandview(const Arg *arg)
         if (!ts || ts == selmon->tagset[selmon->seltags]) {
                 if (ts && selmon->sel->tags != ts) {
                         selmon->sel->tags = ts;
-                        XChangeProperty(dpy, selmon->sel->win, netatom[NetWMDesktop], XA_CARDINAL,
-                                        32, PropModeReplace, (unsigned char *) &t, 1);
+                        setclientdesktop(selmon->sel, t);
                         drawbar(selmon);
                         return;
                 }
@@ -3019,8 +5314,7 @@ tagandview(const Arg *arg)
         }
         selmon->seltags ^= 1;
         selmon->sel->tags = selmon->tagset[selmon->seltags] = ts;
-        XChangeProperty(dpy, selmon->sel->win, netatom[NetWMDesktop], XA_CARDINAL,
-                        32, PropModeReplace, (unsigned char *) &t, 1);
+        setclientdesktop(selmon->sel, t);
         selmon->pertag->prevtag = selmon->pertag->curtag;
         selmon->pertag->curtag = t;
         updatepertag();
@@ -3055,6 +5349,7 @@ deckhor(Monitor *m)
 void
 tiledeckhor(Monitor *m, int deck)
 {
+        TRACE_FUNC();
 	Client *c;
 
         if (m->ntiles == 1) {
@@ -3142,6 +5437,7 @@ deckver(Monitor *m)
 void
 tiledeckver(Monitor *m, int deck)
 {
+        TRACE_FUNC();
 	Client *c;
 
         if (m->ntiles == 1) {
@@ -3270,6 +5566,19 @@ toggletag(const Arg *arg)
 	}
 }
 
+/* Starts tracing spans, or stops and writes the traced ones to TRACEFILE. */
+void
+toggletrace(const Arg *arg)
+{
+        if (!trace_on) {
+                trace_start();
+                return;
+        }
+        trace_stop();
+        if (trace_dump(TRACEFILE) != 0)
+                fputs("dwm: failed to write tracefile\n", stderr);
+}
+
 void
 toggleview(const Arg *arg)
 {
@@ -3345,6 +5654,40 @@ togglewin(const Arg *arg)
         spawn(&((Win *)(arg->v))->cmd);
 }
 
+/* Keeps the pointer position of pointer and key events for getrootptr, other
+ * events leave it unknown. */
+void
+trackpointer(XEvent *e)
+{
+        switch (e->type) {
+        case ButtonPress:
+        case ButtonRelease:
+                ptrx = e->xbutton.x_root;
+                ptry = e->xbutton.y_root;
+                ptrvalid = e->xbutton.same_screen;
+                break;
+        case MotionNotify:
+                ptrx = e->xmotion.x_root;
+                ptry = e->xmotion.y_root;
+                ptrvalid = e->xmotion.same_screen;
+                break;
+        case EnterNotify:
+        case LeaveNotify:
+                ptrx = e->xcrossing.x_root;
+                ptry = e->xcrossing.y_root;
+                ptrvalid = e->xcrossing.same_screen;
+                break;
+        case KeyPress:
+        case KeyRelease:
+                ptrx = e->xkey.x_root;
+                ptry = e->xkey.y_root;
+                ptrvalid = e->xkey.same_screen;
+                break;
+        default:
+                ptrvalid = 0;
+        }
+}
+
 void
 unfocus(Client *c)
 {
@@ -3368,13 +5711,15 @@ unhideifhidden(Client *c, unsigned int tag)
 void
 unmanage(Client *c, int destroyed)
 {
+        TRACE_FUNC();
 	Monitor *m = c->mon;
 
+        opbegin(OpUnmanage);
 	detach(c);
 	detachstack(c);
 	if (!destroyed) {
 		XGrabServer(dpy); /* avoid race conditions */
-		XSetErrorHandler(xerrordummy);
+		ignorebegin();
 		XSelectInput(dpy, c->win, NoEventMask);
                 if (c->isfullscreen)
                         setfullscreen(c, 0);
@@ -3384,14 +5729,73 @@ unmanage(Client *c, int destroyed)
                 }
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
 		setclientstate(c, WithdrawnState);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
+		ignoreend();
 		XUngrabServer(dpy);
 	}
+        if (c->journaled.win) {
+                JournalRecord r = { .kind = JournalGone };
+
+                r.u.c.win = c->win;
+                journalappend(&r);
+        }
+        windel(c->win);
 	free(c);
 	focus(NULL);
 	updateclientlist();
 	arrange(m);
+        opend();
+}
+
+/* unmanage for all clients on exit: one server grab for the lot, the clients
+ * restored as unmanage does and their borders too, the client lists published
+ * once and no focus or arrange in between. */
+void
+unmanageall(void)
+{
+        TRACE_FUNC();
+        int n = 0;
+        Client *c;
+        Monitor *m;
+        Window *wins;
+        XWindowChanges wc;
+
+        for (m = mons; m; m = m->next)
+                for (c = m->clients; c; c = c->next)
+                        n++;
+        wins = ecalloc(n ? n : 1, sizeof(Window));
+        n = 0;
+        XGrabServer(dpy);
+        ignorebegin();
+        for (m = mons; m; m = m->next) {
+                while ((c = m->clients)) {
+                        m->clients = c->next;
+                        wins[n++] = c->win;
+                        XSelectInput(dpy, c->win, NoEventMask);
+                        if (c->isfullscreen)
+                                setfullscreen(c, 0);
+                        if (c->isfloating <= 0) {
+                                c->isfloating = 1;
+                                resize(c, c->sfx, c->sfy, c->sfw, c->sfh, 0);
+                        }
+                        /* the border the client had before dwm, oldbw is
+                         * overwritten by setfullscreen */
+                        wc.border_width = c->origbw;
+                        XConfigureWindow(dpy, c->win, CWBorderWidth, &wc);
+                        XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
+                        setclientstate(c, WithdrawnState);
+                        windel(c->win);
+                        free(c);
+                }
+                m->stack = m->sel = NULL;
+                m->dirty = 0;
+        }
+        XRestackWindows(dpy, wins, n);
+        ignoreend();
+        XUngrabServer(dpy);
+        free(wins);
+        desktopsdirty = 0;
+        updateclientlist();
+        updateclientstacking();
 }
 
 void
@@ -3412,6 +5816,17 @@ unmapnotify(XEvent *e)
         }
 }
 
+void
+unschedule(void (*func)(void))
+{
+        for (int i = 0; i < ntimers; i++)
+                if (timers[i].func == func) {
+                        timers[i] = timers[--ntimers];
+                        updatetimer();
+                        return;
+                }
+}
+
 void
 updatebarpos(Monitor *m)
 {
@@ -3464,6 +5879,7 @@ updatebars(void)
 		m->barwin = XCreateWindow(dpy, root, m->wx, m->by, m->ww, bh, 0, DefaultDepth(dpy, screen),
 				CopyFromParent, DefaultVisual(dpy, screen),
 				CWOverrideRedirect|CWBackPixmap|CWEventMask, &wab);
+                winadd(m->barwin, WinBar, m);
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
@@ -3472,6 +5888,7 @@ updatebars(void)
 		m->tabwin = XCreateWindow(dpy, root, m->wx, m->ty, m->ww, th, 0, DefaultDepth(dpy, screen),
                                 CopyFromParent, DefaultVisual(dpy, screen),
                                 CWOverrideRedirect|CWBackPixmap|CWEventMask, &wat);
+                winadd(m->tabwin, WinTab, m);
 		XDefineCursor(dpy, m->tabwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->tabwin);
 		XSetClassHint(dpy, m->tabwin, &ch);
@@ -3480,6 +5897,22 @@ updatebars(void)
                 XRaiseWindow(dpy, systray->win);
 }
 
+/* Lists the grabs of focused clients for the current numlockmask. */
+void
+updatebuttongrabs(void)
+{
+        unsigned int i, j;
+        unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
+
+        nbuttongrabs = 0;
+        for (i = 0; i < LENGTH(buttons); i++)
+                if (buttons[i].click == ClkClientWin || buttons[i].click == ClkLast)
+                        for (j = 0; j < LENGTH(modifiers); j++) {
+                                buttongrabs[nbuttongrabs].button = buttons[i].button;
+                                buttongrabs[nbuttongrabs++].mod = buttons[i].mask | modifiers[j];
+                        }
+}
+
 void
 updateclientdesktop(Client *c, unsigned int tag)
 {
@@ -3508,8 +5941,7 @@ skip:
                 t += 1 + LENGTH(tags);
         }
 update:
-	XChangeProperty(dpy, c->win, netatom[NetWMDesktop], XA_CARDINAL,
-                        32, PropModeReplace, (unsigned char *) &t, 1);
+        setclientdesktop(c, t);
 }
 
 void
@@ -3517,13 +5949,33 @@ updateclientlist(void)
 {
 	Client *c;
 	Monitor *m;
+        Window *wins;
+        int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+                        n++;
+        wins = ecalloc(n ? n : 1, sizeof(Window));
+        n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+                        wins[n++] = c->win;
+        XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)wins, n);
+        free(wins);
+}
+
+/* Publishes the lineup of stacklineup, at most once per frame. */
+void
+updateclientstacking(void)
+{
+        int n;
+        Window *wins = stacklineup(&n);
+
+        XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)wins, n);
+        free(wins);
+        stackingdirty = stackinglineup = 0;
 }
 
 void
@@ -3644,10 +6096,60 @@ updategeom(void)
 void
 updategeomhints(Client *c)
 {
-        updatesizehints(c->win, &c->sh);
-	c->isfixed = (c->sh.maxw && c->sh.maxh && c->sh.maxw == c->sh.minw
-                                               && c->sh.maxh == c->sh.minh);
-        c->hintsvalid = 1;
+	long msize;
+	XSizeHints size;
+
+	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
+		size.flags = PSize;
+        setgeomhints(c, &size);
+}
+
+/* Follows a keymap or modifier change, the key grabs are only resent where
+ * they differ. */
+void
+updategrabs(void)
+{
+        unsigned int oldmask = numlockmask;
+
+        updatenumlockmask();
+        if (numlockmask != oldmask) {
+                updatebuttongrabs();
+                for (Monitor *m = mons; m; m = m->next)
+                        for (Client *c = m->clients; c; c = c->next)
+                                if (c->grabs == GrabsFocused) {
+                                        XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
+                                        c->grabs = GrabsNone;
+                                        grabbuttons(c, 1);
+                                }
+        }
+        grabkeys();
+}
+
+/* Snapshots the unshifted keysym of each keycode from the XKB keymap, or the
+ * core one without XKB, which keypress and grabkeys use instead of asking Xlib
+ * key by key. */
+void
+updatekeymap(void)
+{
+        int k, start, end, skip;
+        KeySym *syms;
+        XkbDescPtr xkb;
+
+        memset(keysyms, 0, sizeof keysyms);
+        /* the first level of the first group, whichever layout is active */
+        if (xkbevent && (xkb = XkbGetMap(dpy, XkbKeyTypesMask|XkbKeySymsMask, XkbUseCoreKbd))) {
+                for (k = xkb->min_key_code; k <= xkb->max_key_code; k++)
+                        if (XkbKeyNumGroups(xkb, k))
+                                keysyms[k] = XkbKeySymEntry(xkb, k, 0, 0);
+                XkbFreeKeyboard(xkb, 0, True);
+                return;
+        }
+        XDisplayKeycodes(dpy, &start, &end);
+        if (!(syms = XGetKeyboardMapping(dpy, start, end - start + 1, &skip)))
+                return;
+        for (k = start; k <= end; k++)
+                keysyms[k] = syms[(k - start) * skip];
+        XFree(syms);
 }
 
 void
@@ -3659,26 +6161,28 @@ updatentiles(Monitor *m)
                         m->ntiles++;
 }
 
+/* Only at startup and on MappingNotify, see grabkeys and grabbuttons. */
 void
 updatenumlockmask(void)
 {
 	unsigned int i, j;
+	KeyCode numlock;
 	XModifierKeymap *modmap;
 
 	numlockmask = 0;
 	modmap = XGetModifierMapping(dpy);
+        numlock = XKeysymToKeycode(dpy, XK_Num_Lock);
 	for (i = 0; i < 8; i++)
 		for (j = 0; j < modmap->max_keypermod; j++)
-			if (modmap->modifiermap[i * modmap->max_keypermod + j] ==
-                                        XKeysymToKeycode(dpy, XK_Num_Lock)) {
+			if (numlock && modmap->modifiermap[i * modmap->max_keypermod + j] == numlock)
 				numlockmask = (1 << i);
-                        }
 	XFreeModifiermap(modmap);
 }
 
 void
 updatepertag(void)
 {
+        TRACE_FUNC();
         unsigned int ct = selmon->pertag->curtag, pt = selmon->pertag->prevtag;
         unsigned int prevtagset;
         Client *c;
@@ -3710,6 +6214,7 @@ updateselmon(Monitor *m)
         Monitor *p = selmon;
 
         selmon = m;
+        stackingdirty = 1;
         updateselmonhelper(p);
 }
 
@@ -3734,37 +6239,7 @@ updatesizehints(Window w, SizeHints *sh)
 	if (!XGetWMNormalHints(dpy, w, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
-	if (size.flags & PBaseSize) {
-		sh->basew = size.base_width;
-		sh->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		sh->basew = size.min_width;
-		sh->baseh = size.min_height;
-	} else
-		sh->basew = sh->baseh = 0;
-	if (size.flags & PResizeInc) {
-		sh->incw = size.width_inc;
-		sh->inch = size.height_inc;
-	} else
-		sh->incw = sh->inch = 0;
-	if (size.flags & PMaxSize) {
-		sh->maxw = size.max_width;
-		sh->maxh = size.max_height;
-	} else
-		sh->maxw = sh->maxh = 0;
-	if (size.flags & PMinSize) {
-		sh->minw = size.min_width;
-		sh->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		sh->minw = size.base_width;
-		sh->minh = size.base_height;
-	} else
-		sh->minw = sh->minh = 0;
-	if (size.flags & PAspect) {
-		sh->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		sh->maxa = (float)size.max_aspect.x / size.max_aspect.y;
-	} else
-		sh->maxa = sh->mina = 0.0;
+        setsizehints(sh, &size);
 }
 
 void
@@ -3898,59 +6373,63 @@ updatesystraymon(void)
         }
 }
 
+/* arms the timerfd for the earliest pending timer, disarms it if there's none
+ * so that an idle dwm is never woken up */
+void
+updatetimer(void)
+{
+        long long due = 0;
+        struct itimerspec its = {0};
+
+        for (int i = 0; i < ntimers; i++)
+                if (!due || timers[i].due < due)
+                        due = timers[i].due;
+        if (due) {
+                its.it_value.tv_sec = due / 1000;
+                its.it_value.tv_nsec = due % 1000 * 1000000;
+        }
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
 void
 updatetitle(Client *c)
 {
 	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
 		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
-	if (c->name[0] == '\0') /* hack to mark broken clients */
-		strcpy(c->name, broken);
-	applyfribidi(c->name);
+        applytitle(c);
 }
 
 void
 updatewindowtype(Client *c, int new)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
-
-	if (state == netatom[NetWMFullscreen])
-		setfullscreen(c, 1);
-	if (wtype == netatom[NetWMWindowTypeDialog]) {
-                c->isfloating = new ? 1 : -1;
-                c->bw = 0;
-        }
+        applywindowtype(c, getatomprop(c, netatom[NetWMState]),
+                        getatomprop(c, netatom[NetWMWindowType]), new);
 }
 
+/* Refreshes the cached hints of c, on WM_HINTS changes only. */
 void
 updatewmhints(Client *c)
 {
 	XWMHints *wmh;
 
 	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else {
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-			if (c->isurgent)
-				XSetWindowBorder(dpy, c->win, scheme[SchemeUrg][ColBorder].pixel);
-		}
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
+                c->hints = *wmh;
+                c->hashints = 1;
 		XFree(wmh);
-	}
+                setwmhints(c, &c->hints);
+	} else
+                c->hashints = 0;
 }
 
 void
 view(const Arg *arg)
 {
+        TRACE_FUNC();
 	int i;
 
 	if ((arg->ui & TAGMASK) == selmon->tagset[selmon->seltags])
 		return;
+        opbegin(OpView);
 	selmon->seltags ^= 1; /* toggle sel tagset */
 	if (arg->ui & TAGMASK) {
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
@@ -3966,55 +6445,141 @@ view(const Arg *arg)
         updatepertag();
 	focus(NULL);
 	arrange(selmon);
+        opend();
+}
+
+/* window registry: every window dwm knows about (clients, systray icons, bars
+ * and tab bars) is kept in a hash table keyed by window id, which grows
+ * whenever it gets more entries than buckets, so lookups are O(1) */
+#define WINHASH(W, B)                   ((unsigned int)(((W) * 2654435761u) & 0xffffffff) >> (32 - (B)))
+
+void
+winadd(Window w, int kind, void *p)
+{
+        unsigned int h;
+        Entry *r, **old;
+
+        if ((r = winentry(w))) {
+                /* a toplevel's geometry is owned by its entry */
+                if (r->kind == WinToplevel && r->p != p)
+                        free(r->p);
+                r->kind = kind;
+                r->p = p;
+                return;
+        }
+        if (++wintablecount > (1u << wintablebits)) {
+                unsigned int n = 1u << wintablebits;
+
+                old = wintable;
+                wintable = ecalloc(n << 1, sizeof(Entry *));
+                wintablebits++;
+                for (unsigned int j = 0; j < n; j++)
+                        while ((r = old[j])) {
+                                old[j] = r->next;
+                                h = WINHASH(r->win, wintablebits);
+                                r->next = wintable[h];
+                                wintable[h] = r;
+                        }
+                free(old);
+        }
+        r = ecalloc(1, sizeof(Entry));
+        r->win = w;
+        r->kind = kind;
+        r->p = p;
+        h = WINHASH(w, wintablebits);
+        r->next = wintable[h];
+        wintable[h] = r;
+}
+
+void
+windel(Window w)
+{
+        Entry **tr, *r;
+
+        for (tr = &wintable[WINHASH(w, wintablebits)]; *tr && (*tr)->win != w; tr = &(*tr)->next);
+        if (!(r = *tr))
+                return;
+        *tr = r->next;
+        free(r);
+        wintablecount--;
+}
+
+Entry *
+winentry(Window w)
+{
+        Entry *r;
+
+        for (r = wintable[WINHASH(w, wintablebits)]; r && r->win != w; r = r->next);
+        return r;
 }
 
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+        Entry *r = winentry(w);
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+        return r && r->kind == WinClient ? r->p : NULL;
 }
 
 Icon *
 wintosystrayicon(Window w)
 {
-        Icon *i;
+        Entry *r = winentry(w);
 
-        if (!systray)
-                return NULL;
-        for (i = systray->icons; i && i->win != w; i = i->next);
-        return i;
+        return r && r->kind == WinIcon ? r->p : NULL;
 }
 
 Monitor *
 wintomon(Window w)
 {
 	int x, y;
-	Client *c;
-	Monitor *m;
+        Entry *r;
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1);
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin || w == m->tabwin)
-			return m;
-	if ((c = wintoclient(w)))
-		return c->mon;
+        if (!(r = winentry(w)))
+                return selmon;
+        switch (r->kind) {
+        case WinClient:
+                return ((Client *)r->p)->mon;
+        case WinBar:
+        case WinTab:
+                return r->p;
+        }
 	return selmon;
 }
 
+void
+writestats(FILE *fp)
+{
+        fprintf(fp, "dwm-"VERSION" coalesced events: %lu\n\n", evcoalesced);
+        stats_dump(fp, "event", evstats, LENGTH(evstats));
+        fputc('\n', fp);
+        stats_dump(fp, "operation", opstats, LENGTH(opstats));
+        /* counts are inclusive of nested operations */
+        fprintf(fp, "\n%-20s %10s %10s %10s %10s %10s\n", "operation", "calls",
+                "roundtrips", "requests", "rt/call", "req/call");
+        for (int i = 0; i < OpLast; i++)
+                if (opreqs[i].calls)
+                        fprintf(fp, "%-20s %10lu %10lu %10lu %10.2f %10.2f\n",
+                                opstats[i].name, opreqs[i].calls, opreqs[i].roundtrips,
+                                opreqs[i].requests,
+                                (double)opreqs[i].roundtrips / opreqs[i].calls,
+                                (double)opreqs[i].requests / opreqs[i].calls);
+}
+
 /* There's no way to check accesses to destroyed windows, thus those cases are
  * ignored (especially on UnmapNotify's). Other types of errors call Xlibs
  * default error handler, which may call exit. */
 int
 xerror(Display *dpy, XErrorEvent *ee)
 {
+        for (unsigned int i = 0; i < ignorecount; i++) {
+                unsigned int j = (ignorehead + IGNORERANGES - 1 - i) % IGNORERANGES;
+
+                if (ee->serial >= ignores[j].start && ee->serial <= ignores[j].end)
+                        return 0;
+        }
 	if (ee->error_code == BadWindow
 	|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
 	|| (ee->request_code == X_PolyText8 && ee->error_code == BadDrawable)
@@ -4031,12 +6596,6 @@ xerror(Display *dpy, XErrorEvent *ee)
 	return xerrorxlib(dpy, ee); /* may call exit */
 }
 
-int
-xerrordummy(Display *dpy, XErrorEvent *ee)
-{
-	return 0;
-}
-
 /* Startup Error handler to check if another window manager
  * is already running. */
 int
@@ -4046,6 +6605,19 @@ xerrorstart(Display *dpy, XErrorEvent *ee)
 	return -1;
 }
 
+void
+xkbnotify(XEvent *e)
+{
+        XkbEvent *ev = (XkbEvent *)e;
+
+        if (ev->any.xkb_type != XkbMapNotify && ev->any.xkb_type != XkbNewKeyboardNotify)
+                return;
+        if (ev->any.xkb_type == XkbMapNotify)
+                XkbRefreshKeyboardMapping(&ev->map);
+        updatekeymap();
+        updategrabs();
+}
+
 void
 zoom(const Arg *arg)
 {
@@ -4061,12 +6633,21 @@ zoom(const Arg *arg)
 int
 main(int argc, char *argv[])
 {
+        const char *recordpath = NULL, *replaypath = NULL;
+
 	if (argc == 2 && !strcmp("-v", argv[1])) {
 		die("dwm-"VERSION);
         } else if (argc == 2 && !strcmp("-r", argv[1])) {
                 runningstate = Restarted;
+        } else if (argc == 3 && !strcmp("-h", argv[1])) {
+                runningstate = Restarted;
+                hotfd = atoi(argv[2]);
+        } else if (argc == 3 && !strcmp("-t", argv[1])) {
+                recordpath = argv[2];
+        } else if (argc == 3 && !strcmp("-p", argv[1])) {
+                replaypath = argv[2];
         } else if (argc != 1) {
-		die("usage: dwm [-v]");
+		die("usage: dwm [-v] [-t trace] [-p trace]");
         }
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
@@ -4074,19 +6655,46 @@ main(int argc, char *argv[])
 		die("dwm: cannot open display");
 	checkotherwm();
 	setup();
-	scan();
-        if (runningstate == Restarted)
-                restoresession();
+        if (hotfd >= 0 && hotrestore(hotfd)) {
+                hotfd = -1;
+                scan(); /* windows mapped meanwhile */
+                if (unlink(SESSIONFILE) != 0 && errno != ENOENT)
+                        fputs("dwm: failed to delete sessionfile\n", stderr);
+        } else {
+                hotfd = -1;
+                scan();
+                if (runningstate == Restarted)
+                        restoresession();
+                else
+                        journalreplay();
+        }
         runningstate = Running;
-	run();
-        if (runningstate == Restart)
+        if (replaypath) {
+                replay(replaypath);
+                runningstate = Stop;
+        } else {
+                if (recordpath)
+                        record(recordpath);
+                journalsnapshot();
+                run();
+        }
+        /* the session file is for a dwm that can't take the state over */
+        if (runningstate == Restart) {
                 savesession();
+                hotfd = hotsave();
+        }
 	cleanup();
         restorestatus();
 	XCloseDisplay(dpy);
 	if (runningstate == Restart) {
-                char *rargv[] =  { argv[0], "-r", NULL };
+                char fd[16];
+                char *rargv[] =  { argv[0], "-r", NULL, NULL };
 
+                if (hotfd >= 0) {
+                        snprintf(fd, sizeof fd, "%d", hotfd);
+                        rargv[1] = "-h";
+                        rargv[2] = fd;
+                }
                 execvp(rargv[0], rargv);
         }
 	return EXIT_SUCCESS;
@@ -0,0 +1,266 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+#include "record.h"
+#include "util.h"
+
+#define MAGIC                           "dwmtrace"
+#define ATOMSEEN                        1024 /* atoms whose name was written */
+
+static Display *dpy;
+static FILE *out;
+static Atom netwmstate;
+static Atom seen[ATOMSEEN];
+static unsigned long long last; /* us of the previous record */
+
+static const unsigned short evsizes[LASTEvent] = {
+	[KeyPress] = sizeof(XKeyEvent),
+	[KeyRelease] = sizeof(XKeyEvent),
+	[ButtonPress] = sizeof(XButtonEvent),
+	[ButtonRelease] = sizeof(XButtonEvent),
+	[MotionNotify] = sizeof(XMotionEvent),
+	[EnterNotify] = sizeof(XCrossingEvent),
+	[LeaveNotify] = sizeof(XCrossingEvent),
+	[FocusIn] = sizeof(XFocusChangeEvent),
+	[FocusOut] = sizeof(XFocusChangeEvent),
+	[KeymapNotify] = sizeof(XKeymapEvent),
+	[Expose] = sizeof(XExposeEvent),
+	[GraphicsExpose] = sizeof(XGraphicsExposeEvent),
+	[NoExpose] = sizeof(XNoExposeEvent),
+	[VisibilityNotify] = sizeof(XVisibilityEvent),
+	[CreateNotify] = sizeof(XCreateWindowEvent),
+	[DestroyNotify] = sizeof(XDestroyWindowEvent),
+	[UnmapNotify] = sizeof(XUnmapEvent),
+	[MapNotify] = sizeof(XMapEvent),
+	[MapRequest] = sizeof(XMapRequestEvent),
+	[ReparentNotify] = sizeof(XReparentEvent),
+	[ConfigureNotify] = sizeof(XConfigureEvent),
+	[ConfigureRequest] = sizeof(XConfigureRequestEvent),
+	[GravityNotify] = sizeof(XGravityEvent),
+	[ResizeRequest] = sizeof(XResizeRequestEvent),
+	[CirculateNotify] = sizeof(XCirculateEvent),
+	[CirculateRequest] = sizeof(XCirculateRequestEvent),
+	[PropertyNotify] = sizeof(XPropertyEvent),
+	[SelectionClear] = sizeof(XSelectionClearEvent),
+	[SelectionRequest] = sizeof(XSelectionRequestEvent),
+	[SelectionNotify] = sizeof(XSelectionEvent),
+	[ColormapNotify] = sizeof(XColormapEvent),
+	[ClientMessage] = sizeof(XClientMessageEvent),
+	[MappingNotify] = sizeof(XMappingEvent),
+	[GenericEvent] = sizeof(XGenericEvent),
+};
+
+static unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+put(int kind, const void *data, size_t len, const void *extra, size_t extralen)
+{
+	unsigned long long t = now();
+	RecHead h = { kind, 0, len + extralen, t - last < ~0U ? t - last : ~0U };
+
+	if (!out)
+		return;
+	last = t;
+	if (fwrite(&h, sizeof h, 1, out) != 1
+	|| (len && fwrite(data, len, 1, out) != 1)
+	|| (extralen && fwrite(extra, extralen, 1, out) != 1)) {
+		fputs("dwm: failed to write trace, recording stopped\n", stderr);
+		rec_stop();
+	}
+}
+
+/* writes the name of a, once per atom; predefined atoms are the same everywhere */
+static void
+putatom(Atom a)
+{
+	RecAtomData d = { a };
+	size_t i = a * 2654435761u & (ATOMSEEN - 1), n;
+	char *name;
+
+	if (a <= XA_LAST_PREDEFINED)
+		return;
+	for (n = 0; n < ATOMSEEN && seen[i] && seen[i] != a; n++)
+		i = (i + 1) & (ATOMSEEN - 1);
+	if (n < ATOMSEEN) {
+		if (seen[i] == a)
+			return;
+		seen[i] = a;
+	}
+	if (!(name = XGetAtomName(dpy, a)))
+		return;
+	put(RecAtom, &d, sizeof d, name, MIN(strlen(name), REC_MAXDATA - sizeof d));
+	XFree(name);
+}
+
+static void
+putprop(Window w, Atom prop)
+{
+	RecPropData d = { w, prop, None, 0, 0 };
+	Atom type;
+	int format;
+	unsigned long i, nitems, after;
+	unsigned char *p = NULL;
+	void *items = NULL;
+	size_t size = 0;
+
+	putatom(prop);
+	if (out && XGetWindowProperty(dpy, w, prop, 0L, (REC_MAXDATA - sizeof d) / 4,
+	                              False, AnyPropertyType, &type, &format, &nitems,
+	                              &after, &p) == Success && p && type != None) {
+		putatom(type);
+		d.type = type;
+		d.format = format;
+		d.nitems = nitems;
+		if (format == 32) {
+			/* Xlib hands out longs, the trace stores 32 bits */
+			unsigned int *v = ecalloc(nitems ? nitems : 1, sizeof *v);
+
+			for (i = 0; i < nitems; i++) {
+				v[i] = ((unsigned long *)p)[i];
+				if (type == XA_ATOM)
+					putatom(v[i]);
+			}
+			items = v;
+			size = nitems * sizeof *v;
+		} else {
+			items = p;
+			size = nitems * (format / 8);
+		}
+	}
+	put(RecProp, &d, sizeof d, items, size);
+	if (items != p)
+		free(items);
+	if (p)
+		XFree(p);
+}
+
+/* the geometry and all properties a map request is about to look at */
+static void
+putwindow(Window w)
+{
+	XWindowAttributes wa;
+	RecWindowData d;
+	Atom *props;
+	int i, n;
+
+	if (!XGetWindowAttributes(dpy, w, &wa))
+		return;
+	d = (RecWindowData){ w, wa.x, wa.y, wa.width, wa.height, wa.border_width };
+	put(RecWindow, &d, sizeof d, NULL, 0);
+	if (!(props = XListProperties(dpy, w, &n)))
+		return;
+	for (i = 0; i < n && out; i++)
+		putprop(w, props[i]);
+	XFree(props);
+}
+
+int
+rec_start(Display *d, const char *path)
+{
+	if (!(out = fopen(path, "w"))) {
+		fprintf(stderr, "dwm: cannot open trace '%s'\n", path);
+		return 0;
+	}
+	dpy = d;
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+	fputs(MAGIC, out);
+	last = now();
+	netwmstate = XInternAtom(dpy, "_NET_WM_STATE", False);
+	return 1;
+}
+
+void
+rec_stop(void)
+{
+	FILE *fp = out;
+
+	if (!fp)
+		return;
+	out = NULL;
+	if (fclose(fp) != 0)
+		fputs("dwm: failed to close trace\n", stderr);
+}
+
+void
+rec_alias(Window win, int what, int num)
+{
+	RecAliasData d = { win, what, num };
+
+	put(RecAlias, &d, sizeof d, NULL, 0);
+}
+
+void
+rec_batch(void)
+{
+	put(RecBatch, NULL, 0, NULL, 0);
+}
+
+void
+rec_event(XEvent *ev, int grabbed)
+{
+	if (!out)
+		return;
+	switch (ev->type) {
+	case MapRequest:
+		putwindow(ev->xmaprequest.window);
+		break;
+	case PropertyNotify:
+		if (ev->xproperty.state == PropertyDelete) {
+			RecPropData d = { ev->xproperty.window, ev->xproperty.atom, None, 0, 0 };
+
+			putatom(d.atom);
+			put(RecProp, &d, sizeof d, NULL, 0);
+		} else
+			putprop(ev->xproperty.window, ev->xproperty.atom);
+		break;
+	case ClientMessage:
+		putatom(ev->xclient.message_type);
+		if (ev->xclient.message_type == netwmstate) {
+			putatom(ev->xclient.data.l[1]);
+			putatom(ev->xclient.data.l[2]);
+		}
+		break;
+	}
+	put(grabbed ? RecGrabbed : RecEvent, ev, rec_evsize(ev->type), NULL, 0);
+}
+
+FILE *
+rec_open(const char *path)
+{
+	char magic[sizeof MAGIC - 1];
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		return NULL;
+	if (fread(magic, sizeof magic, 1, fp) != 1 || memcmp(magic, MAGIC, sizeof magic)) {
+		fclose(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+/* reads the next record into h and data, which holds REC_MAXDATA bytes */
+int
+rec_read(FILE *fp, RecHead *h, void *data)
+{
+	return fread(h, sizeof *h, 1, fp) == 1
+	       && (!h->len || fread(data, h->len, 1, fp) == 1);
+}
+
+size_t
+rec_evsize(int type)
+{
+	return type >= 0 && type < LASTEvent && evsizes[type] ? evsizes[type] : sizeof(XEvent);
+}
@@ -0,0 +1,50 @@
+/* See LICENSE file for copyright and license details. */
+
+#define REC_MAXDATA                     65535 /* max payload of a record */
+
+/* A trace is the header "dwmtrace" followed by records, each a RecHead and
+ * len bytes of payload in the byte order of the recording machine. Events
+ * drained by the main loop end with a RecBatch, events taken inside a pointer
+ * grab are RecGrabbed. Window, property and atom records precede the event
+ * that needs them. */
+enum { RecEvent, RecGrabbed, RecBatch, RecAtom, RecWindow, RecProp, RecAlias }; /* record kinds */
+enum { RecRoot, RecBar, RecTab }; /* aliased windows created by dwm */
+
+typedef struct {
+	unsigned char kind;
+	unsigned char pad;
+	unsigned short len;
+	unsigned int usec; /* since the previous record, saturated */
+} RecHead;
+
+typedef struct { /* followed by the name */
+	unsigned int atom;
+} RecAtomData;
+
+typedef struct {
+	unsigned int win;
+	int x, y, w, h, bw;
+} RecWindowData;
+
+typedef struct { /* followed by nitems items of format bits, 32 bit as int */
+	unsigned int win, atom, type;
+	int format; /* 0 if the property was deleted */
+	unsigned int nitems;
+} RecPropData;
+
+typedef struct {
+	unsigned int win;
+	int what, num; /* Rec{Root,Bar,Tab} and monitor number */
+} RecAliasData;
+
+/* recording */
+int rec_start(Display *dpy, const char *path);
+void rec_stop(void);
+void rec_alias(Window win, int what, int num);
+void rec_batch(void);
+void rec_event(XEvent *ev, int grabbed);
+
+/* replay, RecEvent payloads are the leading rec_evsize bytes of an XEvent */
+FILE *rec_open(const char *path);
+int rec_read(FILE *fp, RecHead *h, void *data);
+size_t rec_evsize(int type);
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Runs dwm on a private Xvfb through a scripted session and fails if any
+# operation waits for more round trips per call than allowed by the budget.
+# usage: rtbench.sh [budget]
+
+budget=${1:-rtbudget}
+stats=/tmp/dwm-stats
+display=${RTBENCHDISPLAY:-:97}
+
+command -v Xvfb >/dev/null || { echo "rtbench: Xvfb not found" >&2; exit 1; }
+command -v xsetroot >/dev/null || { echo "rtbench: xsetroot not found" >&2; exit 1; }
+
+Xvfb "$display" -screen 0 1280x800x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+pids=
+trap 'kill $pids $xvfb 2>/dev/null' EXIT INT TERM
+export DISPLAY="$display"
+i=0
+until xsetroot -name "" 2>/dev/null; do
+	i=$((i + 1))
+	[ $i -gt 50 ] && { echo "rtbench: Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+# fake signals, spaced out so that they aren't coalesced
+fsig() {
+	xsetroot -name "z:$*"
+	sleep 0.2
+}
+
+rm -f "$stats"
+./dwm &
+dwm=$!
+pids="$dwm"
+sleep 1
+
+# clients, each maps a fixed size window and a transient after 5 seconds
+for i in 1 2 3 4 5 6 7 8; do
+	./transient &
+	pids="$pids $!"
+	sleep 0.1
+done
+sleep 6
+
+# tag switching
+for t in 2 4 1 8 1 2 1; do
+	fsig view ui $t
+done
+fsig fclg
+
+# unmanage
+kill $(echo "$pids" | cut -d' ' -f2-) 2>/dev/null
+sleep 1
+fsig stat
+kill "$dwm" 2>/dev/null
+
+[ -f "$stats" ] || { echo "rtbench: no statistics written" >&2; exit 1; }
+sed -n '/rt\/call/,$p' "$stats"
+awk '
+	FNR == NR {
+		if ($0 !~ /^#/ && NF == 2)
+			max[$1] = $2
+		next
+	}
+	/rt\/call/ { table = 1; next }
+	table && NF == 6 { seen[$1] = $5 }
+	END {
+		for (op in max) {
+			if (!(op in seen)) {
+				printf "rtbench: %s not exercised\n", op
+				fail = 1
+			} else if (seen[op] > max[op] + 0.005) {
+				printf "rtbench: %s: %.2f round trips per call, budget %s\n",
+				       op, seen[op], max[op]
+				fail = 1
+			}
+		}
+		exit fail
+	}' "$budget" "$stats"
@@ -0,0 +1,57 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* upper bound of the bucket holding the q-quantile, capped by the maximum */
+static unsigned long long
+quantile(const Hist *h, double q)
+{
+	unsigned long seen = 0, want = q * h->count + 0.5;
+	size_t i;
+
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < STATS_BUCKETS; i++)
+		if ((seen += h->buckets[i]) >= want)
+			return (2ULL << i) - 1 < h->max ? (2ULL << i) - 1 : h->max;
+	return h->max;
+}
+
+void
+stats_add(Hist *h, unsigned long long ns)
+{
+	size_t i = ns ? 63 - __builtin_clzll(ns) : 0; /* floor(log2(ns)) */
+
+	h->buckets[i < STATS_BUCKETS ? i : STATS_BUCKETS - 1]++;
+	h->count++;
+	h->total += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+void
+stats_dump(FILE *fp, const char *title, const Hist *h, size_t n)
+{
+	size_t i;
+
+	fprintf(fp, "%-20s %10s %10s %10s %10s %12s\n",
+	        title, "count", "p50(us)", "p99(us)", "max(us)", "total(ms)");
+	for (i = 0; i < n; i++) {
+		if (!h[i].count || !h[i].name)
+			continue;
+		fprintf(fp, "%-20s %10lu %10.1f %10.1f %10.1f %12.1f\n", h[i].name, h[i].count,
+		        quantile(&h[i], 0.50) / 1e3, quantile(&h[i], 0.99) / 1e3,
+		        h[i].max / 1e3, h[i].total / 1e6);
+	}
+}
+
+unsigned long long
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
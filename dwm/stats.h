@@ -0,0 +1,22 @@
+/* See LICENSE file for copyright and license details. */
+
+#define STATS_BUCKETS                   40 /* log2 buckets of nanoseconds */
+
+/* times stmt into the histogram h */
+#define STATS_TIME(h, stmt)             do { \
+                                                unsigned long long stats_t0 = stats_now(); \
+\
+                                                stmt; \
+                                                stats_add((h), stats_now() - stats_t0); \
+                                        } while (0)
+
+typedef struct {
+	const char *name;
+	unsigned long count;
+	unsigned long long total, max; /* ns */
+	unsigned long buckets[STATS_BUCKETS];
+} Hist;
+
+void stats_add(Hist *h, unsigned long long ns);
+void stats_dump(FILE *fp, const char *title, const Hist *h, size_t n);
+unsigned long long stats_now(void);
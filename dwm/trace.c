@@ -0,0 +1,88 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+typedef struct {
+	const char *name;
+	unsigned long seq; /* span number, 0 for a free slot */
+	unsigned long long start, end; /* ns, end 0 while open */
+} Span;
+
+int trace_on;
+
+static Span spans[TRACE_SPANS];
+static unsigned long seq;
+
+static unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* opens a span, overwriting the oldest once the ring is full */
+unsigned long
+trace_begin(const char *name)
+{
+	Span *s = &spans[++seq & (TRACE_SPANS - 1)];
+
+	s->name = name;
+	s->seq = seq;
+	s->end = 0;
+	s->start = now();
+	return seq;
+}
+
+/* writes the closed spans in the ring as Chrome trace-event JSON */
+int
+trace_dump(const char *path)
+{
+	FILE *fp;
+	unsigned long i, first = seq >= TRACE_SPANS ? seq - TRACE_SPANS + 1 : 1;
+	const char *sep = "";
+	Span *s;
+
+	if (!(fp = fopen(path, "w")))
+		return -1;
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", fp);
+	for (i = first; i <= seq; i++) {
+		s = &spans[i & (TRACE_SPANS - 1)];
+		if (s->seq != i || !s->end)
+			continue;
+		fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+		        "\"ts\":%.3f,\"dur\":%.3f}", sep, s->name,
+		        s->start / 1e3, (s->end - s->start) / 1e3);
+		sep = ",\n";
+	}
+	fputs("\n]}\n", fp);
+	return fclose(fp);
+}
+
+/* closes a span unless the ring has reused its slot meanwhile */
+void
+trace_end(unsigned long span)
+{
+	Span *s = &spans[span & (TRACE_SPANS - 1)];
+
+	if (s->seq == span)
+		s->end = now();
+}
+
+void
+trace_start(void)
+{
+	for (unsigned long i = 0; i < TRACE_SPANS; i++)
+		spans[i].seq = 0;
+	seq = 0;
+	trace_on = 1;
+}
+
+void
+trace_stop(void)
+{
+	trace_on = 0;
+}
@@ -0,0 +1,24 @@
+/* See LICENSE file for copyright and license details. */
+
+#define TRACE_SPANS                     (1 << 16) /* ring of the latest spans, power of 2 */
+
+/* Traces the enclosing scope as a span called name while tracing is on; off
+ * it costs a load and a branch on entry and exit. */
+#define TRACE_SPAN(name)                unsigned long trace_span __attribute__((cleanup(trace_leave))) \
+                                                = trace_on ? trace_begin(name) : 0
+#define TRACE_FUNC()                    TRACE_SPAN(__func__)
+
+extern int trace_on;
+
+unsigned long trace_begin(const char *name);
+int trace_dump(const char *path);
+void trace_end(unsigned long span);
+void trace_start(void);
+void trace_stop(void);
+
+static inline void
+trace_leave(unsigned long *span)
+{
+	if (*span)
+		trace_end(*span);
+}
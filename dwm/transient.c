@@ -1,40 +1,180 @@
-/* cc transient.c -o transient -lX11 */
+/* cc transient.c -o transient -lX11
+ *
+ * Test client and load generator. Without options it maps a fixed size
+ * window and, five seconds later, a transient for it. The rates apply to
+ * every window; SIGUSR1 pauses and resumes them. */
 
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
-int main(void) {
+enum { Title, Configure, Urgency, RateLast }; /* rate driven actions */
+
+static volatile sig_atomic_t toggled;
+
+static void
+toggle(int sig)
+{
+	toggled = 1;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+	fputs("usage: transient [-n windows] [-c class] [-r role] [-s wxh] [-t delay] [-f]\n"
+	      "                 [-m titles/s] [-C configures/s] [-u urgency toggles/s] [-p]\n",
+	      stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
 	Display *d;
-	Window r, f, t = None;
+	Window r, *f, *t;
 	XSizeHints h;
+	XClassHint ch;
+	XWMHints wmh = { .flags = 0 };
 	XEvent e;
+	struct pollfd pfd;
+	struct sigaction sa = { .sa_handler = toggle };
+	Atom fs;
+	char name[64], instance[64], *class = "Transient", *role = NULL;
+	int i, k, c, n = 1, w = 400, hh = 400, fullscreen = 0, paused = 0, mapped = 0;
+	unsigned long serial = 0;
+	double delay = 5, rate[RateLast] = { 0 }, next[RateLast], start, tm, due;
+
+	while ((c = getopt(argc, argv, "n:c:r:s:t:fm:C:u:p")) != -1) {
+		switch (c) {
+		case 'n': n = atoi(optarg); break;
+		case 'c': class = optarg; break;
+		case 'r': role = optarg; break;
+		case 's': if (sscanf(optarg, "%dx%d", &w, &hh) != 2) usage(); break;
+		case 't': delay = atof(optarg); break;
+		case 'f': fullscreen = 1; break;
+		case 'm': rate[Title] = atof(optarg); break;
+		case 'C': rate[Configure] = atof(optarg); break;
+		case 'u': rate[Urgency] = atof(optarg); break;
+		case 'p': paused = 1; break;
+		default: usage();
+		}
+	}
+	if (optind < argc || n < 1)
+		usage();
+	sigaction(SIGUSR1, &sa, NULL);
 
 	d = XOpenDisplay(NULL);
 	if (!d)
 		exit(1);
 	r = DefaultRootWindow(d);
+	f = calloc(n, sizeof *f);
+	t = calloc(n, sizeof *t);
+	if (!f || !t)
+		exit(1);
 
-	f = XCreateSimpleWindow(d, r, 100, 100, 400, 400, 0, 0, 0);
-	h.min_width = h.max_width = h.min_height = h.max_height = 400;
+	for (i = 0; class[i] && i < (int)sizeof instance - 1; i++)
+		instance[i] = class[i] >= 'A' && class[i] <= 'Z' ? class[i] + 'a' - 'A' : class[i];
+	instance[i] = '\0';
+	ch.res_name = instance;
+	ch.res_class = class;
+	h.min_width = h.max_width = w;
+	h.min_height = h.max_height = hh;
 	h.flags = PMinSize | PMaxSize;
-	XSetWMNormalHints(d, f, &h);
-	XStoreName(d, f, "floating");
-	XMapWindow(d, f);
+	fs = XInternAtom(d, "_NET_WM_STATE_FULLSCREEN", False);
+	for (i = 0; i < n; i++) {
+		if (w > 0 && hh > 0) {
+			f[i] = XCreateSimpleWindow(d, r, 100, 100, w, hh, 0, 0, 0);
+			XSetWMNormalHints(d, f[i], &h);
+		} else /* no size hints, -s 0x0 */
+			f[i] = XCreateSimpleWindow(d, r, 100, 100, 400, 400, 0, 0, 0);
+		XSetClassHint(d, f[i], &ch);
+		if (role)
+			XChangeProperty(d, f[i], XInternAtom(d, "WM_WINDOW_ROLE", False), XA_STRING,
+			                8, PropModeReplace, (unsigned char *)role, strlen(role));
+		if (fullscreen)
+			XChangeProperty(d, f[i], XInternAtom(d, "_NET_WM_STATE", False), XA_ATOM,
+			                32, PropModeReplace, (unsigned char *)&fs, 1);
+		snprintf(name, sizeof name, "client %d", i);
+		XStoreName(d, f[i], n == 1 ? "floating" : name);
+		XSelectInput(d, f[i], ExposureMask);
+		XMapWindow(d, f[i]);
+	}
+	XFlush(d);
 
-	XSelectInput(d, f, ExposureMask);
+	start = now();
+	for (k = 0; k < RateLast; k++)
+		next[k] = start;
+	pfd.fd = ConnectionNumber(d);
+	pfd.events = POLLIN;
 	while (1) {
-		XNextEvent(d, &e);
-
-		if (t == None) {
-			sleep(5);
-			t = XCreateSimpleWindow(d, r, 50, 50, 100, 100, 0, 0, 0);
-			XSetTransientForHint(d, t, f);
-			XStoreName(d, t, "transient");
-			XMapWindow(d, t);
-			XSelectInput(d, t, ExposureMask);
+		while (XPending(d))
+			XNextEvent(d, &e);
+		if (toggled) {
+			toggled = 0;
+			paused = !paused;
+			for (k = 0; k < RateLast; k++)
+				next[k] = now();
 		}
+		tm = now();
+
+		if (delay >= 0 && !mapped && tm >= start + delay) {
+			for (i = 0; i < n; i++) {
+				t[i] = XCreateSimpleWindow(d, r, 50, 50, 100, 100, 0, 0, 0);
+				XSetTransientForHint(d, t[i], f[i]);
+				XStoreName(d, t[i], "transient");
+				XMapWindow(d, t[i]);
+				XSelectInput(d, t[i], ExposureMask);
+			}
+			mapped = 1;
+		}
+		for (k = 0; k < RateLast && !paused; k++) {
+			if (rate[k] <= 0)
+				continue;
+			if (next[k] < tm - 1) /* fell behind, don't burst */
+				next[k] = tm;
+			for (; next[k] <= tm; next[k] += 1 / rate[k]) {
+				if (k == Urgency)
+					wmh.flags ^= XUrgencyHint;
+				for (i = 0; i < n; i++) {
+					switch (k) {
+					case Title:
+						snprintf(name, sizeof name, "client %d title %lu", i, serial++);
+						XStoreName(d, f[i], name);
+						break;
+					case Configure:
+						XMoveResizeWindow(d, f[i], rand() % 400, rand() % 300,
+						                  100 + rand() % 400, 100 + rand() % 300);
+						break;
+					case Urgency:
+						XSetWMHints(d, f[i], &wmh);
+						break;
+					}
+				}
+			}
+		}
+		XFlush(d);
+
+		due = -1;
+		if (delay >= 0 && !mapped)
+			due = start + delay;
+		for (k = 0; k < RateLast && !paused; k++)
+			if (rate[k] > 0 && (due < 0 || next[k] < due))
+				due = next[k];
+		poll(&pfd, 1, due < 0 ? -1 : (int)((due - tm) * 1000) + 1);
 	}
 
 	XCloseDisplay(d);